@@ -0,0 +1,270 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <openssl/evp.h>
+#include "fixtureserver.h"
+#include "hostname.h"
+
+static const char LAST_MODIFIED[]{"Thu, 30 Mar 2017 00:00:00 GMT"};
+
+static std::string lower(std::string text) {
+    foldCase(&text[0], text.length());
+    return text;
+}
+
+static bool sendAll(int client, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t sent = send(client, data, length, MSG_NOSIGNAL);
+        if (sent <= 0) return false;
+        data += sent;
+        length -= static_cast<size_t>(sent);
+    }
+    return true;
+}
+
+static FixtureList parseList(const std::string &path) {
+    FixtureList list;
+    size_t query = path.find('?');
+    if (query == std::string::npos) return list;
+
+    std::string params = path.substr(query + 1);
+    size_t start{0};
+    while (start < params.length()) {
+        size_t end = params.find('&', start);
+        if (end == std::string::npos) end = params.length();
+        std::string param = params.substr(start, end - start);
+        size_t equals = param.find('=');
+
+        if (equals != std::string::npos) {
+            std::string key = param.substr(0, equals);
+            unsigned long value = std::strtoul(param.c_str() + equals + 1, nullptr, 10);
+            if (key == "entries") list.entries = value;
+            else if (key == "seed") list.seed = static_cast<unsigned>(value);
+            else if (key == "latency") list.latencyMs = static_cast<int>(value);
+            else if (key == "rate") list.bytesPerSecond = value;
+            else if (key == "fail") list.failure = static_cast<FixtureList::Failure>(value);
+            else if (key == "conditional") list.conditional = value != 0;
+        }
+        start = end + 1;
+    }
+    return list;
+}
+
+static std::string etag(const FixtureList &list) {
+    return "\"" + std::to_string(list.seed) + "-" + std::to_string(list.entries) + "\"";
+}
+
+static std::string sha256(const std::string &data) {
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int length{0};
+    EVP_Digest(data.data(), data.length(), digest, &length, EVP_sha256(), nullptr);
+
+    unsigned char encoded[4 * ((EVP_MAX_MD_SIZE + 2) / 3) + 1];
+    int encodedLength = EVP_EncodeBlock(encoded, digest, static_cast<int>(length));
+    return std::string(reinterpret_cast<char*>(encoded), static_cast<size_t>(encodedLength));
+}
+
+FixtureServer::FixtureServer() {}
+
+FixtureServer::~FixtureServer() { stop(); }
+
+void FixtureServer::start() {
+    m_socket = socket(AF_INET, SOCK_STREAM, 0);
+    if (m_socket < 0)
+        throw std::runtime_error(std::string("Could not create fixture socket: ") + std::strerror(errno));
+
+    int reuse{1};
+    setsockopt(m_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    sockaddr_in local;
+    std::memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_port = 0;
+    local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    socklen_t localLength = sizeof(local);
+    if (bind(m_socket, reinterpret_cast<sockaddr*>(&local), sizeof(local)) != 0 ||
+            listen(m_socket, 64) != 0 ||
+            getsockname(m_socket, reinterpret_cast<sockaddr*>(&local), &localLength) != 0)
+        throw std::runtime_error(std::string("Could not start fixture server: ") + std::strerror(errno));
+
+    m_port = ntohs(local.sin_port);
+    m_running = true;
+    m_acceptThread = std::thread(&FixtureServer::acceptLoop, this);
+}
+
+void FixtureServer::stop() {
+    if (!m_running) return;
+    m_running = false;
+    m_acceptThread.join();
+
+    std::lock_guard<std::mutex> lock(m_clientsMutex);
+    for (std::thread &client : m_clients) client.join();
+    m_clients.clear();
+
+    close(m_socket);
+    m_socket = -1;
+}
+
+uint16_t FixtureServer::port() const { return m_port; }
+
+size_t FixtureServer::requests() const { return m_requests; }
+
+std::string FixtureServer::url(const FixtureList &list) const {
+    return "http://127.0.0.1:" + std::to_string(m_port) + "/hosts?entries=" + std::to_string(list.entries) +
+           "&seed=" + std::to_string(list.seed) + "&latency=" + std::to_string(list.latencyMs) +
+           "&rate=" + std::to_string(list.bytesPerSecond) + "&fail=" + std::to_string(static_cast<int>(list.failure)) +
+           "&conditional=" + std::to_string(list.conditional ? 1 : 0);
+}
+
+std::string FixtureServer::body(const FixtureList &list) {
+    std::string body;
+    body.reserve(list.entries * 40 + 256);
+    body += "# Synthetic hosts list " + std::to_string(list.seed) + "\n"
+            "127.0.0.1 localhost\n"
+            "::1 localhost\n\n";
+
+    // Roughly the shape of the real lists: mostly 0.0.0.0 or 127.0.0.1 entries,
+    // some comments, and a share of domains that other lists carry as well
+    uint32_t state = list.seed * 2654435761u + 1;
+    for (size_t i = 0; i < list.entries; ++i) {
+        state = state * 1664525u + 1013904223u;
+        if (i % 50 == 0) body += "# section " + std::to_string(i / 50) + "\n";
+
+        body += (state & 1) ? "0.0.0.0 " : "127.0.0.1 ";
+        if ((state >> 8) % 4 == 0)
+            body += "shared" + std::to_string((state >> 12) % (list.entries + 1)) + ".ads.example.com\n";
+        else
+            body += "host" + std::to_string(i) + ".list" + std::to_string(list.seed) + ".tracker.example.net\n";
+    }
+    return body;
+}
+
+void FixtureServer::acceptLoop() {
+    pollfd fd;
+    fd.fd = m_socket;
+    fd.events = POLLIN;
+
+    while (m_running) {
+        fd.revents = 0;
+        if (poll(&fd, 1, 100) <= 0 || !(fd.revents & POLLIN)) continue;
+
+        int client = accept(m_socket, nullptr, nullptr);
+        if (client < 0) continue;
+
+        std::lock_guard<std::mutex> lock(m_clientsMutex);
+        m_clients.emplace_back(&FixtureServer::serve, this, client);
+    }
+}
+
+void FixtureServer::serve(int client) {
+    std::string request;
+    char buffer[4096];
+    while (request.find("\r\n\r\n") == std::string::npos && request.length() < 65536) {
+        ssize_t received = recv(client, buffer, sizeof(buffer), 0);
+        if (received <= 0) {
+            close(client);
+            return;
+        }
+        request.append(buffer, static_cast<size_t>(received));
+    }
+    ++m_requests;
+
+    size_t pathStart = request.find(' ');
+    size_t pathEnd = request.find(' ', pathStart + 1);
+    std::string path = request.substr(pathStart + 1, pathEnd - pathStart - 1);
+
+    std::map<std::string, std::string> headers;
+    size_t lineStart = request.find("\r\n") + 2;
+    while (lineStart < request.length()) {
+        size_t lineEnd = request.find("\r\n", lineStart);
+        if (lineEnd == std::string::npos || lineEnd == lineStart) break;
+        std::string line = request.substr(lineStart, lineEnd - lineStart);
+        size_t colon = line.find(':');
+        if (colon != std::string::npos) {
+            size_t value = line.find_first_not_of(' ', colon + 1);
+            headers[lower(line.substr(0, colon))] = value == std::string::npos ? "" : line.substr(value);
+        }
+        lineStart = lineEnd + 2;
+    }
+
+    FixtureList list = parseList(path);
+    if (list.latencyMs > 0)
+        std::this_thread::sleep_for(std::chrono::milliseconds(list.latencyMs));
+
+    std::string response;
+    std::string body;
+    bool ranged{false};
+
+    if (list.failure == FixtureList::SERVER_ERROR) {
+        body = "Internal Server Error\n";
+        response = "HTTP/1.1 500 Internal Server Error\r\n";
+    }
+    else if (list.conditional &&
+             (headers["if-none-match"] == etag(list) || headers["if-modified-since"] == LAST_MODIFIED)) {
+        response = "HTTP/1.1 304 Not Modified\r\n"
+                   "ETag: " + etag(list) + "\r\n"
+                   "Connection: close\r\n\r\n";
+        sendAll(client, response.data(), response.length());
+        close(client);
+        return;
+    }
+    else {
+        body = FixtureServer::body(list);
+        std::string common = "ETag: " + etag(list) + "\r\n"
+                             "Last-Modified: " + std::string(LAST_MODIFIED) + "\r\n"
+                             "Accept-Ranges: bytes\r\n"
+                             "Digest: SHA-256=" + sha256(body) + "\r\n";
+
+        // Only open-ended ranges are needed to resume a download
+        std::string range = headers["range"];
+        size_t from = range.compare(0, 6, "bytes=") == 0 ? std::strtoul(range.c_str() + 6, nullptr, 10) : 0;
+        bool current = headers.count("if-range") == 0 || headers["if-range"] == etag(list);
+
+        if (!range.empty() && current && from < body.length()) {
+            ranged = true;
+            response = "HTTP/1.1 206 Partial Content\r\n" + common +
+                       "Content-Range: bytes " + std::to_string(from) + "-" + std::to_string(body.length() - 1) +
+                       "/" + std::to_string(body.length()) + "\r\n";
+            body = body.substr(from);
+        }
+        else response = "HTTP/1.1 200 OK\r\n" + common;
+    }
+
+    response += "Content-Type: text/plain\r\n"
+                "Content-Length: " + std::to_string(body.length()) + "\r\n"
+                "Connection: close\r\n\r\n";
+
+    if (!sendAll(client, response.data(), response.length())) {
+        close(client);
+        return;
+    }
+
+    // A truncated transfer promises the whole body but stops half way;
+    // resumed requests succeed, like a link that dropped once
+    bool truncate = list.failure == FixtureList::TRUNCATE && !ranged;
+    size_t length = truncate ? body.length() / 2 : body.length();
+
+    if (list.bytesPerSecond == 0) {
+        sendAll(client, body.data(), length);
+    }
+    else {
+        // Send in 50 ms slices to approximate the requested bandwidth
+        size_t slice = std::max<size_t>(1, list.bytesPerSecond / 20);
+        for (size_t sent = 0; sent < length && m_running; sent += slice) {
+            auto next = std::chrono::steady_clock::now() + std::chrono::milliseconds(50);
+            if (!sendAll(client, body.data() + sent, std::min(slice, length - sent))) break;
+            std::this_thread::sleep_until(next);
+        }
+    }
+
+    close(client);
+}
@@ -0,0 +1,59 @@
+#ifndef FIXTURESERVER_H
+#define FIXTURESERVER_H
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// One synthetic hosts list and how the server should misbehave while serving it
+struct FixtureList {
+    enum Failure { NONE, SERVER_ERROR, TRUNCATE };
+
+    size_t entries{10000};
+    unsigned seed{0};
+    int latencyMs{0};
+    size_t bytesPerSecond{0}; // 0 for unthrottled
+    Failure failure{NONE};
+    bool conditional{true};   // Answer matching If-None-Match or If-Modified-Since with a 304
+};
+
+/*
+ * Plain HTTP server on 127.0.0.1 standing in for the hosts file mirrors.
+ * Everything about a list is encoded in its URL (see url()), so the server
+ * itself keeps no state. Lists carry ETag, Last-Modified and Digest headers,
+ * conditional requests that match get a 304 and open-ended Range requests
+ * (with or without If-Range) get a 206.
+ */
+class FixtureServer
+{
+public:
+    FixtureServer();
+    ~FixtureServer();
+
+    void start();
+    void stop();
+
+    uint16_t port() const;
+    std::string url(const FixtureList &list) const;
+    size_t requests() const;
+
+    static std::string body(const FixtureList &list);
+
+private:
+    void acceptLoop();
+    void serve(int client);
+
+    int m_socket{-1};
+    uint16_t m_port{0};
+    std::atomic<bool> m_running{false};
+    std::atomic<size_t> m_requests{0};
+    std::thread m_acceptThread;
+
+    std::mutex m_clientsMutex;
+    std::vector<std::thread> m_clients;
+};
+
+#endif // FIXTURESERVER_H
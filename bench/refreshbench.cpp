@@ -0,0 +1,195 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <ftw.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "pipeline.h"
+#include "fixtureserver.h"
+
+/*
+ * Runs the whole --out pipeline, as main() does through Pipeline (open the
+ * configuration database, download, ingest, write the hosts file and record
+ * the generation), against FixtureServer, so download and ingest strategies
+ * can be compared under repeatable network conditions without touching the
+ * internet.
+ */
+static const std::string ARG_SOURCES{"--sources"};
+static const std::string ARG_ENTRIES{"--entries"};
+static const std::string ARG_LATENCY{"--latency"};
+static const std::string ARG_RATE{"--rate"};
+static const std::string ARG_FAILURES{"--failures"};
+static const std::string ARG_RUNS{"--runs"};
+static const std::string ARG_CONDITIONAL{"--conditional"};
+static const std::string ARG_HELP{"--help"};
+
+struct BenchOptions {
+    int sources{4};
+    size_t entries{50000};
+    int latencyMs{0};
+    size_t bytesPerSecond{0};
+    int failures{0};
+    int runs{1};
+    bool conditional{true};
+};
+
+static void printHelp(char *exeName) {
+    std::cout << "Usage: " << exeName << " [OPTION] [...]\n" <<
+                 "\n" <<
+                 ARG_SOURCES << " [N] Number of hosts sources to serve. Defaults to 4.\n" <<
+                 ARG_ENTRIES << " [N] Entries in each source. Defaults to 50000.\n" <<
+                 ARG_LATENCY << " [MS] Delay before each response starts. Defaults to 0.\n" <<
+                 ARG_RATE << " [BYTES] Throttle each response to this many bytes per second. Defaults to unthrottled.\n" <<
+                 ARG_FAILURES << " [N] Make this many sources fail, alternating HTTP 500 and truncated bodies.\n" <<
+                 ARG_RUNS << " [N] Refresh this many times against the same database. Defaults to 1.\n" <<
+                 ARG_CONDITIONAL << " [0|1] Whether the server answers conditional requests with 304 Not Modified, so\n" <<
+                 "    later runs only re-download changed lists. Defaults to 1.\n" <<
+                 ARG_HELP << " Display this help and exit." << std::endl;
+    std::exit(0);
+}
+
+static BenchOptions parseOptions(int argc, char *argv[]) {
+    BenchOptions options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == ARG_HELP) printHelp(argv[0]);
+        if (i+1 >= argc) throw std::invalid_argument("Missing argument to flag " + arg);
+
+        long value = std::strtol(argv[++i], nullptr, 10);
+        if (value < 0) throw std::invalid_argument(arg + " must not be negative");
+
+        if (arg == ARG_SOURCES) options.sources = static_cast<int>(value);
+        else if (arg == ARG_ENTRIES) options.entries = static_cast<size_t>(value);
+        else if (arg == ARG_LATENCY) options.latencyMs = static_cast<int>(value);
+        else if (arg == ARG_RATE) options.bytesPerSecond = static_cast<size_t>(value);
+        else if (arg == ARG_FAILURES) options.failures = static_cast<int>(value);
+        else if (arg == ARG_RUNS) options.runs = static_cast<int>(value);
+        else if (arg == ARG_CONDITIONAL) options.conditional = value != 0;
+        else throw std::invalid_argument("Unknown flag " + arg);
+    }
+    return options;
+}
+
+static double secondsSince(const std::chrono::steady_clock::time_point &start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void removeTree(const std::string &dir) {
+    nftw(dir.c_str(), [](const char *path, const struct stat *, int, FTW *) -> int {
+        return std::remove(path);
+    }, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+// One run of the pipeline, as ShadowHosts --out does it. Prints the run's
+// figures without ending the line
+static int runOnce(int run, const std::string &configFile, const std::string &outFile,
+                   const std::vector<std::string> &urls) {
+    RefreshStats stats;
+    auto start = std::chrono::steady_clock::now();
+
+    Pipeline pipeline(configFile);
+    if (run == 1) {
+        // Swap the default sources for the fixture URLs, which are plain http on
+        // a loopback port and so have to skip the HTTPS check
+        pipeline.configure([&urls](Config &config) -> bool {
+            for (const SourceHealth &source : config.sourceHealth()) config.rmHostsSrc(source.url);
+            for (const std::string &url : urls) config.addHostsSrc(url, false);
+            return true;
+        });
+    }
+    double open = secondsSince(start);
+
+    if (!pipeline.refresh(&stats)) return EXIT_FAILURE;
+
+    auto saveStart = std::chrono::steady_clock::now();
+    pipeline.writeHostsFile(outFile);
+    double save = secondsSince(saveStart);
+    double total = secondsSince(start);
+
+    std::cout << "run " << run << ": total " << total << " s"
+              << ", open " << open << " s"
+              << ", download " << stats.downloadSeconds << " s"
+              << ", ingest " << stats.ingestSeconds << " s"
+              << ", save " << save << " s"
+              << ", " << stats.bytes << " bytes, " << stats.lines << " lines"
+              << ", " << stats.failures << "/" << stats.sources << " sources failed"
+              << ", " << stats.retries << " retries, " << stats.skipped << " skipped"
+              << ", " << stats.notModified << " not modified" << std::flush;
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[]) {
+    BenchOptions options;
+    try {
+        options = parseOptions(argc, argv);
+    }
+    catch (std::invalid_argument &e) {
+        std::cout << argv[0] << ": " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    char workDir[] = "/tmp/shadowhosts-bench-XXXXXX";
+    if (mkdtemp(workDir) == nullptr) {
+        std::perror("Failed to create a working directory");
+        return EXIT_FAILURE;
+    }
+    std::string configFile = std::string(workDir) + "/config.db";
+    std::string outFile = std::string(workDir) + "/hosts";
+
+    FixtureServer server;
+    server.start();
+
+    std::vector<std::string> urls;
+    for (int i = 0; i < options.sources; ++i) {
+        FixtureList list;
+        list.entries = options.entries;
+        list.seed = static_cast<unsigned>(i);
+        list.latencyMs = options.latencyMs;
+        list.bytesPerSecond = options.bytesPerSecond;
+        list.conditional = options.conditional;
+        if (i < options.failures)
+            list.failure = (i % 2 == 0) ? FixtureList::SERVER_ERROR : FixtureList::TRUNCATE;
+        urls.push_back(server.url(list));
+    }
+
+    std::cout << "sources " << options.sources << ", entries/source " << options.entries
+              << ", latency " << options.latencyMs << " ms, rate "
+              << (options.bytesPerSecond == 0 ? std::string("unthrottled") : std::to_string(options.bytesPerSecond) + " B/s")
+              << ", failures " << options.failures
+              << ", conditional requests " << (options.conditional ? "answered" : "ignored") << "\n";
+    std::cout << std::fixed << std::setprecision(3);
+
+    // Each run opens the database afresh, like one invocation of ShadowHosts --out.
+    // Runs happen in a child process, so their peak RSS leaves out FixtureServer
+    bool failed{false};
+    for (int run = 1; run <= options.runs; ++run) {
+        std::cout.flush();
+        pid_t child = fork();
+        if (child < 0) {
+            std::perror("Failed to start a run");
+            failed = true;
+            break;
+        }
+        if (child == 0) _exit(runOnce(run, configFile, outFile, urls));
+
+        int status;
+        rusage usage;
+        if (wait4(child, &status, 0, &usage) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+            std::cout << "run " << run << " failed" << std::endl;
+            failed = true;
+            break;
+        }
+        std::cout << ", peak RSS " << usage.ru_maxrss << " KB\n";
+    }
+
+    std::cout << server.requests() << " HTTP requests" << std::endl;
+
+    server.stop();
+    removeTree(workDir);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
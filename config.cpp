@@ -1,12 +1,16 @@
+#include <algorithm>
 #include <string>
+#include <ctime>
 #include <sqlite++/stmt.hpp>
 #include <sqlite++/row.hpp>
 #include <sqlite++/exception.hpp>
 #include "config.h"
+#include "hostname.h"
+#include "generations.h"
 
 const std::regex Config::ipRegex{"^([01]?\\d\\d?|2[0-4]\\d|25[0-5])(\\.([01]?\\d\\d?|2[0-4]\\d|25[0-5])){3}$",
                             std::regex::ECMAScript | std::regex::optimize};
-const std::regex Config::domainRegex{"^(([a-zA-Z0-9\\-])+\\.)*([a-z]){2,}$",
+const std::regex Config::domainRegex{"^(([a-zA-Z0-9\\-])+\\.)*(([a-z]){2,}|xn--([a-z0-9\\-])+)$",
                             std::regex::ECMAScript | std::regex::optimize};
 const std::regex Config::urlRegex{"https:\\/\\/((\\w|-)+)?(\\.(\\w|-)+)*"
                             "(\\/(\\w|_|-|.|~|(%(2[1346789ABCF]|3[ABDF]|40|5[BD])))*)*"
@@ -21,18 +25,32 @@ const std::string Config::DEFAULT_IP{"127.0.0.1"};
 const std::string Config::HOSTS_TABLE{"hosts"};
 const std::string Config::CONFIG_TABLE{"config"};
 const std::string Config::BLACKLIST_TABLE{"blacklist"};
+const std::string Config::BLACKLIST_PATTERN_TABLE{"blacklist_patterns"};
 const std::string Config::WHITELIST_TABLE{"whitelist"};
 const std::string Config::REDIRECT_TABLE{"redirect"};
 const std::string Config::ENTRIES_TABLE{"entries"};
+const std::string Config::GENERATIONS_TABLE{"generations"};
+const int Config::DEFAULT_GENERATIONS_KEPT{10};
+static const std::string GENERATIONS_KEPT_OPTION{"generations_kept"};
 
 static const std::string WHITESPACE{" \t\r\n"};
 
 Config::Config(const std::string &file): m_db{file} {
     m_db.open();
+    // Readers don't wait for a writer in WAL mode, so listing or serving goes on
+    // while another process ingests; writers wait for each other instead of failing
+    m_db.execute("PRAGMA journal_mode = WAL");
+    m_db.execute("PRAGMA busy_timeout = 5000");
 }
 
 Config::~Config() { m_db.close(); }
 
+void Config::beginTransaction() { m_db.execute("BEGIN"); }
+
+void Config::commitTransaction() { m_db.execute("COMMIT"); }
+
+void Config::rollbackTransaction() { m_db.execute("ROLLBACK"); }
+
 void Config::prepare() {
     std::string statement{"CREATE TABLE IF NOT EXISTS " + CONFIG_TABLE + "("
                             "option_name TEXT NOT NULL PRIMARY KEY UNIQUE, "
@@ -45,11 +63,24 @@ void Config::prepare() {
                    "enabled INT NOT NULL DEFAULT 1 CHECK(enabled IN(0, 1))"
                    ")";
     m_db.execute(statement);
+    addColumn(HOSTS_TABLE, "etag", "TEXT NOT NULL DEFAULT ''");
+    addColumn(HOSTS_TABLE, "content_length", "INT NOT NULL DEFAULT 0");
+    addColumn(HOSTS_TABLE, "sha256", "TEXT NOT NULL DEFAULT ''");
+    addColumn(HOSTS_TABLE, "last_latency", "INT NOT NULL DEFAULT 0");
+    addColumn(HOSTS_TABLE, "throughput", "INT NOT NULL DEFAULT 0");
+    addColumn(HOSTS_TABLE, "failure_streak", "INT NOT NULL DEFAULT 0");
+    addColumn(HOSTS_TABLE, "last_success", "INT NOT NULL DEFAULT 0");
+    addColumn(HOSTS_TABLE, "last_attempt", "INT NOT NULL DEFAULT 0");
     statement = "CREATE TABLE IF NOT EXISTS " + BLACKLIST_TABLE + "("
                    "domain TEXT NOT NULL PRIMARY KEY UNIQUE CHECK(domain IS NOT 'localhost'), "
                    "enabled INT NOT NULL DEFAULT 1 CHECK(enabled IN(0, 1))"
                    ")";
     m_db.execute(statement);
+    statement = "CREATE TABLE IF NOT EXISTS " + BLACKLIST_PATTERN_TABLE + "("
+                   "pattern TEXT NOT NULL PRIMARY KEY UNIQUE, "
+                   "enabled INT NOT NULL DEFAULT 1 CHECK(enabled IN(0, 1))"
+                   ")";
+    m_db.execute(statement);
     statement = "CREATE TABLE IF NOT EXISTS " + WHITELIST_TABLE + "("
                    "domain TEXT NOT NULL PRIMARY KEY UNIQUE CHECK(domain IS NOT 'localhost'), "
                    "enabled INT NOT NULL DEFAULT 1 CHECK(enabled IN(0, 1))"
@@ -70,6 +101,31 @@ void Config::prepare() {
                    "FOREIGN KEY(source) REFERENCES " + HOSTS_TABLE + "(id)"
                    ")";
     m_db.execute(statement);
+    statement = "CREATE TABLE IF NOT EXISTS " + GENERATIONS_TABLE + "("
+                   "id INTEGER PRIMARY KEY AUTOINCREMENT, "
+                   "created INT NOT NULL, "
+                   "entries INT NOT NULL, "
+                   "config TEXT NOT NULL, "
+                   "data TEXT NOT NULL"
+                   ")";
+    m_db.execute(statement);
+
+    // Rows stored before hostnames were normalized at ingest may differ only by
+    // case or trailing dots; fold them together once
+    SQLite::Stmt version = m_db.prepare("PRAGMA user_version");
+    int schemaVersion{0};
+    version.exec([&schemaVersion](SQLite::Row &row) mutable -> void {
+        schemaVersion = row.getInt(0);
+    });
+    if (schemaVersion < 1) {
+        for (const std::string &table : {ENTRIES_TABLE, BLACKLIST_TABLE, WHITELIST_TABLE, REDIRECT_TABLE}) {
+            std::string normalized{"lower(rtrim(domain, '.'))"};
+            // Rows whose normalized form already exists are left behind by OR IGNORE, so drop them
+            m_db.execute("UPDATE OR IGNORE " + table + " SET domain = " + normalized + " WHERE domain != " + normalized);
+            m_db.execute("DELETE FROM " + table + " WHERE domain != " + normalized);
+        }
+        m_db.execute("PRAGMA user_version = 1");
+    }
 
     SQLite::Stmt countHosts = m_db.prepare("SELECT COUNT(*) FROM " + HOSTS_TABLE);
     int count;
@@ -80,32 +136,66 @@ void Config::prepare() {
     if (count == 0) resetDB();
 }
 
+// Databases created by older versions lack columns added since, so add them on demand
+void Config::addColumn(const std::string &table, const std::string &column, const std::string &definition) {
+    bool exists{false};
+    SQLite::Stmt info = m_db.prepare("PRAGMA table_info(" + table + ")");
+    info.exec([&column, &exists](SQLite::Row &row) mutable -> void {
+        if (row.getString(1) == column) exists = true;
+    });
+
+    if (!exists)
+        m_db.execute("ALTER TABLE " + table + " ADD COLUMN " + column + " " + definition);
+}
+
 void Config::configure() {
+    m_hostURLs.clear();
     SQLite::Stmt urls = m_db.prepare("SELECT url FROM " + HOSTS_TABLE + " WHERE enabled = 1");
     std::string url;
+    // Sources were checked by addHostsSrc() when they were added
     urls.exec([this, &url](SQLite::Row &row) mutable -> void {
         url = row.getString(0);
-        if (std::regex_match(url, this->urlRegex))
-            this->m_hostURLs.emplace_back(url);
+        this->m_hostURLs.emplace_back(url);
     });
 }
 
 const std::vector<std::string>& Config::getHostUrls() { return m_hostURLs; }
 
 const std::string& Config::getRedirectIP() const { return m_redirectIP; }
-const std::string& Config::outFile() const { return m_outFile; }
+const std::string& Config::cacheDir() const { return m_cacheDir; }
+
+void Config::cacheDir(const std::string &dir) { m_cacheDir = dir; }
+
+void Config::compilePatterns(PatternMatcher &matcher) {
+    SQLite::Stmt patterns = m_db.prepare("SELECT pattern FROM " + BLACKLIST_PATTERN_TABLE + " WHERE enabled = 1");
+    patterns.exec([&matcher](SQLite::Row &row) mutable -> void {
+        try {
+            matcher.add(row.getString(0));
+        }
+        catch (std::invalid_argument &e) {
+            // Only valid patterns are inserted, so skip anything else
+        }
+    });
+    matcher.compile();
+}
 
-void Config::saveToFile() {
+void Config::merge(HostsFile &hosts) {
     std::string ip, domain;
-    HostsFile hosts;
+
+    // Compiled once so that every entry is checked against all patterns in one pass
+    PatternMatcher patterns;
+    compilePatterns(patterns);
 
     SQLite::Stmt save = m_db.prepare("SELECT DISTINCT e.ip, e.domain FROM " + ENTRIES_TABLE + " AS e JOIN " + HOSTS_TABLE +
                                      " AS h ON e.source = h.id WHERE e.enabled = 1 AND h.enabled = 1");
-    save.exec([this, &hosts, &ip, &domain](SQLite::Row &row) mutable -> void {
+    save.exec([this, &hosts, &patterns, &ip, &domain](SQLite::Row &row) mutable -> void {
         ip = row.getString(0);
         domain = row.getString(1);
 
-        if ((ip == DEFAULT_IP || m_allowRedirectionInHosts) && std::regex_match(ip, ipRegex) && std::regex_match(domain, domainRegex)) {
+        if (patterns.matches(domain) && std::regex_match(domain, domainRegex)) {
+            hosts.insert(m_redirectIP, domain);
+        }
+        else if ((ip == DEFAULT_IP || m_allowRedirectionInHosts) && std::regex_match(ip, ipRegex) && std::regex_match(domain, domainRegex)) {
             hosts.insert((ip == DEFAULT_IP ? m_redirectIP : ip), domain);
         }
     });
@@ -137,15 +227,15 @@ void Config::saveToFile() {
             hosts.insert(ip, domain);
         }
     });
-
-    hosts.saveToFile(m_outFile);
 }
 
+
 void Config::resetDB() {
     m_db.execute("DELETE FROM " + CONFIG_TABLE);
     m_db.execute("DELETE FROM " + HOSTS_TABLE);
     m_db.execute("DELETE FROM " + WHITELIST_TABLE);
     m_db.execute("DELETE FROM " + BLACKLIST_TABLE);
+    m_db.execute("DELETE FROM " + BLACKLIST_PATTERN_TABLE);
     m_db.execute("DELETE FROM " + REDIRECT_TABLE);
     m_db.execute("DELETE FROM " + ENTRIES_TABLE);
 
@@ -178,9 +268,6 @@ void Config::setRedirectIP(const std::string &ip) {
     }
 }
 
-void Config::outFile(const std::string &file) {
-    m_outFile = file;
-}
 
 void Config::blacklist(const std::string &domain) {
     if (std::regex_match(domain, domainRegex)) {
@@ -196,6 +283,19 @@ void Config::blacklist(const std::string &domain) {
     }
 }
 
+void Config::blacklistPattern(const std::string &pattern) {
+    PatternMatcher::validate(pattern);
+    try {
+        SQLite::Stmt blacklist = m_db.prepare("INSERT INTO " + BLACKLIST_PATTERN_TABLE + "(pattern) VALUES(:pattern)");
+        blacklist.bindValue(":pattern", pattern);
+        blacklist.exec();
+    }
+    catch (SQLite::except::Constraint &e) {
+        if (!(e.unique() || e.primaryKey()))
+            throw e;
+    }
+}
+
 void Config::whitelist(const std::string &domain) {
     if (std::regex_match(domain, domainRegex)) {
         try {
@@ -225,8 +325,8 @@ void Config::redirect(const std::string &domain, const std::string &ip) {
     }
 }
 
-void Config::addHostsSrc(const std::string &url) {
-    if (std::regex_match(url, urlRegex)) {
+void Config::addHostsSrc(const std::string &url, bool checkURL) {
+    if (!checkURL || std::regex_match(url, urlRegex)) {
         try {
             SQLite::Stmt addSrc = m_db.prepare("INSERT INTO " + HOSTS_TABLE + "(url) VALUES(:url)");
             addSrc.bindValue(":url", url);
@@ -245,6 +345,12 @@ void Config::rmBlacklist(const std::string &domain) {
     blacklist.exec();
 }
 
+void Config::rmBlacklistPattern(const std::string &pattern) {
+    SQLite::Stmt blacklist = m_db.prepare("DELETE FROM " + BLACKLIST_PATTERN_TABLE + " WHERE pattern = :pattern");
+    blacklist.bindValue(":pattern", pattern);
+    blacklist.exec();
+}
+
 void Config::rmWhitelist(const std::string &domain) {
     SQLite::Stmt whitelist = m_db.prepare("DELETE FROM " + WHITELIST_TABLE + " WHERE domain = :domain");
     whitelist.bindValue(":domain", domain);
@@ -263,7 +369,7 @@ void Config::rmHostsSrc(const std::string &url) {
     hostsSrc.exec();
 }
 
-void Config::insertEntry(const std::string &host, const std::string &line) {
+void Config::insertEntry(const std::string &host, std::string &line) {
     std::string domain;
     std::string ip;
 
@@ -280,23 +386,18 @@ void Config::insertEntry(const std::string &host, const std::string &line) {
 
     if (start == std::string::npos || line[start] == '#') return;
     end = line.find_first_of(WHITESPACE, start);
+    if (end == std::string::npos) end = line.length();
+
+    // Normalize before validating, so that every spelling of a name ends up as one entry
+    bool ascii = !foldCase(&line[start], end-start);
+    while (end > start && line[end-1] == '.') --end;
     domain = line.substr(start, end-start);
 
+    if (!ascii && !encodeIDN(domain)) return;
     if (domain == "localhost") return;
     if (!std::regex_match(domain, Config::domainRegex)) return;
 
-    int id{0};
-    try {
-        SQLite::Stmt select = m_db.prepare("SELECT id FROM " + HOSTS_TABLE + " WHERE url = :host");
-        select.bindValue(":host", host);
-
-        select.exec([&id](SQLite::Row &row) mutable -> void {
-            id = row.getInt(0);
-        });
-    }
-    catch(SQLite::except::SQLiteError &e) {
-        // What would be here?
-    }
+    int id = sourceID(host);
 
     if (id > 0) {
         try {
@@ -315,6 +416,118 @@ void Config::insertEntry(const std::string &host, const std::string &line) {
     }
 }
 
+int Config::sourceID(const std::string &url) {
+    int id{0};
+    try {
+        SQLite::Stmt select = m_db.prepare("SELECT id FROM " + HOSTS_TABLE + " WHERE url = :host");
+        select.bindValue(":host", url);
+
+        select.exec([&id](SQLite::Row &row) mutable -> void {
+            id = row.getInt(0);
+        });
+    }
+    catch(SQLite::except::SQLiteError &e) {
+        // What would be here?
+    }
+    return id;
+}
+
+DownloadState Config::downloadState(const std::string &url) {
+    DownloadState state;
+    SQLite::Stmt select = m_db.prepare("SELECT etag, content_length, sha256 FROM " + HOSTS_TABLE + " WHERE url = :url");
+    select.bindValue(":url", url);
+    select.exec([&state](SQLite::Row &row) mutable -> void {
+        state.etag = row.getString(0);
+        state.length = row.getInt(1);
+        state.sha256 = row.getString(2);
+    });
+    return state;
+}
+
+void Config::downloadState(const std::string &url, const DownloadState &state) {
+    SQLite::Stmt update = m_db.prepare("UPDATE " + HOSTS_TABLE + " SET etag = :etag, content_length = :length, "
+                                       "sha256 = :sha256 WHERE url = :url");
+    update.bindValue(":etag", state.etag);
+    update.bindValue(":length", state.length);
+    update.bindValue(":sha256", state.sha256);
+    update.bindValue(":url", url);
+    update.exec();
+}
+
+static const std::string HEALTH_COLUMNS{"id, url, enabled, last_latency, throughput, failure_streak, last_success, last_attempt"};
+
+static SourceHealth readHealth(SQLite::Row &row) {
+    SourceHealth health;
+    health.id = row.getInt(0);
+    health.url = row.getString(1);
+    health.enabled = row.getInt(2) == 1;
+    health.latency = row.getInt(3);
+    health.throughput = row.getInt(4);
+    health.failureStreak = row.getInt(5);
+    // Timestamps are read back as text so they survive 2038
+    health.lastSuccess = std::stoll(row.getString(6));
+    health.lastAttempt = std::stoll(row.getString(7));
+    return health;
+}
+
+SourceHealth Config::sourceHealth(const std::string &url) {
+    SourceHealth health;
+    health.url = url;
+    SQLite::Stmt select = m_db.prepare("SELECT " + HEALTH_COLUMNS + " FROM " + HOSTS_TABLE + " WHERE url = :url");
+    select.bindValue(":url", url);
+    select.exec([&health](SQLite::Row &row) mutable -> void {
+        health = readHealth(row);
+    });
+    return health;
+}
+
+std::vector<SourceHealth> Config::sourceHealth() {
+    std::vector<SourceHealth> sources;
+    SQLite::Stmt select = m_db.prepare("SELECT " + HEALTH_COLUMNS + " FROM " + HOSTS_TABLE + " ORDER BY id");
+    select.exec([&sources](SQLite::Row &row) mutable -> void {
+        sources.push_back(readHealth(row));
+    });
+    return sources;
+}
+
+// Exponentially weighted moving average, so one unusual run moves the
+// history by a quarter; 0 means no sample and keeps the history as it is
+static std::string smoothed(const std::string &column, const std::string &sample) {
+    return "CASE WHEN " + sample + " <= 0 THEN " + column + " WHEN " + column + " = 0 THEN " + sample +
+           " ELSE (3 * " + column + " + " + sample + ") / 4 END";
+}
+
+void Config::recordSuccess(const std::string &url, int latency, int throughput) {
+    std::string now = std::to_string(static_cast<long long>(std::time(nullptr)));
+    SQLite::Stmt update = m_db.prepare("UPDATE " + HOSTS_TABLE + " SET last_latency = " + smoothed("last_latency", ":latency") +
+                                       ", throughput = " + smoothed("throughput", ":throughput") +
+                                       ", failure_streak = 0, last_success = :now, last_attempt = :now WHERE url = :url");
+    update.bindValue(":latency", latency);
+    update.bindValue(":throughput", throughput);
+    update.bindValue(":now", now);
+    update.bindValue(":url", url);
+    update.exec();
+}
+
+void Config::recordThroughput(const std::string &url, int throughput) {
+    SQLite::Stmt update = m_db.prepare("UPDATE " + HOSTS_TABLE + " SET throughput = " + smoothed("throughput", ":throughput") +
+                                       " WHERE url = :url");
+    update.bindValue(":throughput", throughput);
+    update.bindValue(":url", url);
+    update.exec();
+}
+
+void Config::recordFailure(const std::string &url) {
+    std::string now = std::to_string(static_cast<long long>(std::time(nullptr)));
+    SQLite::Stmt update = m_db.prepare("UPDATE " + HOSTS_TABLE + " SET failure_streak = failure_streak + 1, "
+                                       "last_attempt = :now WHERE url = :url");
+    update.bindValue(":now", now);
+    update.bindValue(":url", url);
+    update.exec();
+}
+
+
+
 void Config::toggleBlacklist(const std::string &domain, bool enable) {
     SQLite::Stmt toggle = m_db.prepare("UPDATE " + BLACKLIST_TABLE + " SET enabled = :isset WHERE domain = :id");
     toggle.bindValue(":isset", enable);
@@ -322,6 +535,13 @@ void Config::toggleBlacklist(const std::string &domain, bool enable) {
     toggle.exec();
 }
 
+void Config::toggleBlacklistPattern(const std::string &pattern, bool enable) {
+    SQLite::Stmt toggle = m_db.prepare("UPDATE " + BLACKLIST_PATTERN_TABLE + " SET enabled = :isset WHERE pattern = :id");
+    toggle.bindValue(":isset", enable);
+    toggle.bindValue(":id", pattern);
+    toggle.exec();
+}
+
 void Config::toggleWhitelist(const std::string &domain, bool enable) {
     SQLite::Stmt toggle = m_db.prepare("UPDATE " + WHITELIST_TABLE + " SET enabled = :isset WHERE domain = :id");
     toggle.bindValue(":isset", enable);
@@ -342,3 +562,130 @@ void Config::toggleHostsSource(int index, bool enable) {
     toggle.bindValue(":id", index);
     toggle.exec();
 }
+
+std::string Config::configState() {
+    std::vector<std::string> lines;
+    lines.push_back("allow-redirection " + std::to_string(m_allowRedirectionInHosts ? 1 : 0));
+    lines.push_back("redirect-ip " + m_redirectIP);
+
+    std::string prefix;
+    auto addLine = [&lines, &prefix](SQLite::Row &row) mutable -> void {
+        lines.push_back(prefix + (row.getInt(0) == 1 ? "enabled " : "disabled ") + row.getString(1));
+    };
+    prefix = "source ";
+    m_db.prepare("SELECT enabled, url FROM " + HOSTS_TABLE).exec(addLine);
+    prefix = "blacklist ";
+    m_db.prepare("SELECT enabled, domain FROM " + BLACKLIST_TABLE).exec(addLine);
+    prefix = "blacklist-pattern ";
+    m_db.prepare("SELECT enabled, pattern FROM " + BLACKLIST_PATTERN_TABLE).exec(addLine);
+    prefix = "whitelist ";
+    m_db.prepare("SELECT enabled, domain FROM " + WHITELIST_TABLE).exec(addLine);
+    prefix = "redirect ";
+    m_db.prepare("SELECT enabled, domain || ' ' || ip FROM " + REDIRECT_TABLE).exec(addLine);
+
+    // Sorted, so that two states can be compared with diffLines()
+    std::sort(lines.begin(), lines.end());
+    std::string state;
+    for (const std::string &line : lines) state += line + '\n';
+    return state;
+}
+
+int Config::recordGeneration(HostsFile &hosts) {
+    GenerationWriter writer;
+    hosts.forEach([&writer](const std::string &ip, const std::string &hostname) -> void {
+        writer.add(ip, hostname);
+    });
+    std::string config = configState();
+
+    // Runs that change nothing don't push useful generations out of the history
+    int latest{0};
+    bool unchanged{false};
+    SQLite::Stmt select = m_db.prepare("SELECT id, config, data FROM " + GENERATIONS_TABLE + " ORDER BY id DESC LIMIT 1");
+    select.exec([&latest, &unchanged, &config, &writer](SQLite::Row &row) mutable -> void {
+        latest = row.getInt(0);
+        unchanged = row.getString(1) == config && row.getString(2) == writer.data();
+    });
+    if (unchanged) return latest;
+
+    beginTransaction();
+    try {
+        SQLite::Stmt insert = m_db.prepare("INSERT INTO " + GENERATIONS_TABLE + "(created, entries, config, data) "
+                                           "VALUES(:created, :entries, :config, :data)");
+        insert.bindValue(":created", std::to_string(static_cast<long long>(std::time(nullptr))));
+        insert.bindValue(":entries", writer.entries());
+        insert.bindValue(":config", config);
+        insert.bindValue(":data", writer.data());
+        insert.exec();
+        pruneGenerations();
+    }
+    catch (...) {
+        rollbackTransaction();
+        throw;
+    }
+    commitTransaction();
+
+    SQLite::Stmt newest = m_db.prepare("SELECT MAX(id) FROM " + GENERATIONS_TABLE);
+    newest.exec([&latest](SQLite::Row &row) mutable -> void {
+        latest = row.getInt(0);
+    });
+    return latest;
+}
+
+void Config::pruneGenerations() {
+    SQLite::Stmt prune = m_db.prepare("DELETE FROM " + GENERATIONS_TABLE + " WHERE id NOT IN "
+                                      "(SELECT id FROM " + GENERATIONS_TABLE + " ORDER BY id DESC LIMIT :kept)");
+    prune.bindValue(":kept", generationsKept());
+    prune.exec();
+}
+
+int Config::generationsKept() {
+    int count{DEFAULT_GENERATIONS_KEPT};
+    SQLite::Stmt select = m_db.prepare("SELECT value FROM " + CONFIG_TABLE + " WHERE option_name = :name");
+    select.bindValue(":name", GENERATIONS_KEPT_OPTION);
+    select.exec([&count](SQLite::Row &row) mutable -> void {
+        count = std::stoi(row.getString(0));
+    });
+    return count;
+}
+
+void Config::generationsKept(int count) {
+    if (count <= 0) throw std::invalid_argument("At least one generation has to be kept");
+
+    SQLite::Stmt update = m_db.prepare("INSERT OR REPLACE INTO " + CONFIG_TABLE + "(option_name, value) VALUES(:name, :value)");
+    update.bindValue(":name", GENERATIONS_KEPT_OPTION);
+    update.bindValue(":value", std::to_string(count));
+    update.exec();
+    pruneGenerations();
+}
+
+std::vector<Generation> Config::generations() {
+    std::vector<Generation> generations;
+    SQLite::Stmt select = m_db.prepare("SELECT id, created, entries FROM " + GENERATIONS_TABLE + " ORDER BY id");
+    select.exec([&generations](SQLite::Row &row) mutable -> void {
+        Generation generation;
+        generation.id = row.getInt(0);
+        generation.created = std::stoll(row.getString(1));
+        generation.entries = row.getInt(2);
+        generations.push_back(generation);
+    });
+    return generations;
+}
+
+void Config::generation(int id, std::string &data, std::string &config) {
+    bool found{false};
+    SQLite::Stmt select = m_db.prepare("SELECT data, config FROM " + GENERATIONS_TABLE + " WHERE id = :id");
+    select.bindValue(":id", id);
+    select.exec([&found, &data, &config](SQLite::Row &row) mutable -> void {
+        data = row.getString(0);
+        config = row.getString(1);
+        found = true;
+    });
+
+    if (!found) throw std::invalid_argument("There is no generation " + std::to_string(id));
+}
+
+
+
+
+
+
@@ -2,9 +2,33 @@
 #define SETUP_H
 #include <vector>
 #include <string>
+#include <utility>
 #include <regex>
 #include <sqlite++/db.hpp>
 #include "hostsfile.h"
+#include "patternmatcher.h"
+#include "generations.h"
+
+struct RefreshStats;
+
+// What is known about a source's last, possibly partial, download
+struct DownloadState {
+    std::string etag;
+    int length{0};      // Full size of the list in bytes, 0 if unknown
+    std::string sha256; // Base64 digest the server advertised, if any
+};
+
+// Download history of a source, used to tune its timeouts and retries
+struct SourceHealth {
+    int id{0};
+    std::string url;
+    bool enabled{true};
+    int latency{0};       // Smoothed milliseconds until the first byte, 0 if never measured
+    int throughput{0};    // Smoothed bytes per second, 0 if never measured
+    int failureStreak{0};
+    long long lastSuccess{0}; // Unix time, 0 if never
+    long long lastAttempt{0};
+};
 
 class Config {
     private:
@@ -13,18 +37,42 @@ class Config {
         static const std::string HOSTS_TABLE;
         static const std::string CONFIG_TABLE;
         static const std::string BLACKLIST_TABLE;
+        static const std::string BLACKLIST_PATTERN_TABLE;
         static const std::string WHITELIST_TABLE;
         static const std::string REDIRECT_TABLE;
         static const std::string ENTRIES_TABLE;
+        static const std::string GENERATIONS_TABLE;
+        static const int DEFAULT_GENERATIONS_KEPT;
 
         std::vector<std::string> m_hostURLs;
 
+        void addColumn(const std::string &table, const std::string &column, const std::string &definition);
+        std::string configState();
+        void pruneGenerations();
+
+        // Group changes so that a file-backed database writes them out once.
+        // Transactions don't nest, so these are only for Pipeline and downloadSources(),
+        // which own every transaction; recordGeneration() opens its own.
+        void beginTransaction();
+        void commitTransaction();
+        void rollbackTransaction();
+        void prepare();
+        void configure();
+
+        // Store hosts, with the configuration that produced it, as the newest generation
+        // unless it is the same as the current newest; keeps the last generationsKept().
+        // Returns the ID of the newest generation.
+        int recordGeneration(HostsFile &hosts);
+
+        friend class Pipeline;
+        friend bool downloadSources(Config &config, const std::vector<std::string> &urls, RefreshStats *stats);
+
         bool m_allowRedirectionInHosts{false};
         bool m_isConfiguring{false};
 
         std::string m_redirectIP{DEFAULT_IP};
 
-        std::string m_outFile{""};
+        std::string m_cacheDir{""};
 
         bool m_configOnly{false};
         bool m_removing{false};
@@ -32,26 +80,50 @@ class Config {
     public:
         Config(const std::string &file);
         ~Config();
-        void prepare();
-        void configure();
         const std::vector<std::string>& getHostUrls();
 
         const std::string& getRedirectIP() const;
-        const std::string& outFile() const;
-        void outFile(const std::string &file);
+        // Where downloads are kept between runs; must be private to this user.
+        // If empty, downloadSources() creates a temporary directory.
+        const std::string& cacheDir() const;
+        void cacheDir(const std::string &dir);
         void resetDB();
 
-        void insertEntry(const std::string &host, const std::string &line);
-        void saveToFile();
-        void addHostsSrc(const std::string &url);
+        int sourceID(const std::string &url);
+        DownloadState downloadState(const std::string &url);
+        void downloadState(const std::string &url, const DownloadState &state);
+        SourceHealth sourceHealth(const std::string &url);
+        std::vector<SourceHealth> sourceHealth();
+        // Samples are folded into the smoothed history; pass 0 for no sample
+        void recordSuccess(const std::string &url, int latency, int throughput);
+        void recordThroughput(const std::string &url, int throughput);
+        void recordFailure(const std::string &url);
+
+        // How many generations are kept, saved in the database; setting it prunes older ones
+        int generationsKept();
+        void generationsKept(int count);
+        std::vector<Generation> generations();
+        // Throws std::invalid_argument if there is no such generation
+        void generation(int id, std::string &data, std::string &config);
+
+        // Normalizes the domain in line in place, see hostname.h
+        void insertEntry(const std::string &host, std::string &line);
+        void compilePatterns(PatternMatcher &matcher);
+        void merge(HostsFile &hosts);
+        // checkURL = false also accepts non-HTTPS URLs, e.g. local test servers;
+        // configure() and so Pipeline::refresh() download whatever was accepted
+        void addHostsSrc(const std::string &url, bool checkURL = true);
         void blacklist(const std::string &domain);
+        void blacklistPattern(const std::string &pattern);
         void whitelist(const std::string &domain);
         void redirect(const std::string &domain, const std::string &ip);
         void rmBlacklist(const std::string &domain);
+        void rmBlacklistPattern(const std::string &pattern);
         void rmWhitelist(const std::string &domain);
         void rmRedirect(const std::string &domain);
         void rmHostsSrc(const std::string &domain);
         void toggleBlacklist(const std::string &domain, bool enable);
+        void toggleBlacklistPattern(const std::string &pattern, bool enable);
         void toggleWhitelist(const std::string &domain, bool enable);
         void toggleRedirect(const std::string &domain, bool enable);
         void toggleHostsSource(int index, bool enable);
@@ -64,6 +136,7 @@ class Config {
         static const std::regex domainRegex;
         static const std::regex urlRegex;
 
+    private:
         SQLite::DB m_db;
 };
 
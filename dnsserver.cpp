@@ -0,0 +1,319 @@
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <openssl/rand.h>
+#include "dnsserver.h"
+#include "hostname.h"
+
+const int64_t DNSServer::UPSTREAM_TIMEOUT_MS{5000};
+const uint32_t DNSServer::ANSWER_TTL{60};
+const size_t DNSServer::MAX_PENDING{1024};
+
+static const size_t HEADER_LENGTH{12};
+static const size_t MAX_PACKET{65535};
+static const uint16_t TYPE_A{1};
+static const uint16_t TYPE_AAAA{28};
+static const uint16_t CLASS_IN{1};
+
+static int64_t now() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static uint16_t read16(const unsigned char *data) {
+    return static_cast<uint16_t>((data[0] << 8) | data[1]);
+}
+
+static void write16(unsigned char *data, uint16_t value) {
+    data[0] = static_cast<unsigned char>(value >> 8);
+    data[1] = static_cast<unsigned char>(value & 0xFF);
+}
+
+// Transaction IDs and source ports must be unguessable, or an off-path
+// attacker could forge upstream replies
+static uint16_t random16() {
+    unsigned char bytes[2];
+    if (RAND_bytes(bytes, sizeof(bytes)) != 1)
+        throw std::runtime_error("Could not generate a random transaction ID");
+    return read16(bytes);
+}
+
+// Returns the offset just past the single question in packet, or 0 if
+// packet doesn't hold exactly one well-formed, uncompressed question
+static size_t questionEnd(const unsigned char *packet, size_t length) {
+    if (length < HEADER_LENGTH || read16(packet + 4) != 1) return 0;
+
+    size_t pos{HEADER_LENGTH};
+    size_t nameLength{0};
+    while (pos < length && packet[pos] != 0) {
+        size_t label = packet[pos];
+        nameLength += label + 1;
+        if ((label & 0xC0) != 0 || pos + 1 + label > length || nameLength > 255) return 0;
+        pos += 1 + label;
+    }
+    return pos + 5 <= length ? pos + 5 : 0;
+}
+
+DNSServer::DNSServer(uint16_t port, const std::string &upstreamIP, uint16_t upstreamPort): m_port{port} {
+    std::memset(&m_upstream, 0, sizeof(m_upstream));
+    m_upstream.sin_family = AF_INET;
+    m_upstream.sin_port = htons(upstreamPort);
+    if (inet_pton(AF_INET, upstreamIP.c_str(), &m_upstream.sin_addr) != 1)
+        throw std::invalid_argument(upstreamIP + " is not a valid IP address!");
+}
+
+DNSServer::~DNSServer() {
+    if (m_socket >= 0) close(m_socket);
+    for (auto &pending : m_pending) close(pending.first);
+    delete m_nextIndex.exchange(nullptr);
+}
+
+void DNSServer::bind() {
+    m_socket = socket(AF_INET, SOCK_DGRAM, 0);
+    if (m_socket < 0)
+        throw std::runtime_error(std::string("Could not create DNS socket: ") + std::strerror(errno));
+
+    sockaddr_in local;
+    std::memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_port = htons(m_port);
+    local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (::bind(m_socket, reinterpret_cast<sockaddr*>(&local), sizeof(local)) != 0)
+        throw std::runtime_error("Could not listen on 127.0.0.1:" + std::to_string(m_port) + ": " + std::strerror(errno));
+
+    // Port 0 asks the kernel to choose one; remember what we got
+    socklen_t localLength = sizeof(local);
+    if (getsockname(m_socket, reinterpret_cast<sockaddr*>(&local), &localLength) == 0)
+        m_port = ntohs(local.sin_port);
+
+    // Fail now rather than on the first relayed query if upstream is unreachable
+    int upstream = openUpstreamSocket();
+    if (upstream < 0)
+        throw std::runtime_error(std::string("Could not connect to the upstream DNS server: ") + std::strerror(errno));
+    close(upstream);
+}
+
+int DNSServer::openUpstreamSocket() const {
+    int upstream = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (upstream < 0) return -1;
+
+    // A random source port for every query; leave it to the kernel if a few tries collide
+    sockaddr_in local;
+    std::memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    for (int attempt = 0; attempt < 8; ++attempt) {
+        local.sin_port = htons(static_cast<uint16_t>(1024 + random16() % (65536 - 1024)));
+        if (::bind(upstream, reinterpret_cast<sockaddr*>(&local), sizeof(local)) == 0) break;
+    }
+
+    // Connecting makes the kernel drop replies from anyone but upstream
+    if (connect(upstream, reinterpret_cast<const sockaddr*>(&m_upstream), sizeof(m_upstream)) != 0) {
+        int error = errno;
+        close(upstream);
+        errno = error;
+        return -1;
+    }
+    return upstream;
+}
+
+uint16_t DNSServer::port() const { return m_port; }
+
+void DNSServer::update(std::unique_ptr<DomainIndex> index) {
+    // The serving thread picks this up on its next iteration; an index
+    // that was never picked up is simply replaced
+    delete m_nextIndex.exchange(index.release());
+}
+
+void DNSServer::stop() { m_running = false; }
+
+void DNSServer::run() {
+    if (m_socket < 0) bind();
+
+    std::vector<pollfd> fds;
+    m_running = true;
+    while (m_running) {
+        DomainIndex *next = m_nextIndex.exchange(nullptr);
+        if (next != nullptr) m_index.reset(next);
+
+        fds.resize(1);
+        fds[0].fd = m_socket;
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+        for (auto &pending : m_pending) {
+            pollfd fd;
+            fd.fd = pending.first;
+            fd.events = POLLIN;
+            fd.revents = 0;
+            fds.push_back(fd);
+        }
+
+        int ready = poll(fds.data(), fds.size(), 250);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            throw std::runtime_error(std::string("poll() failed: ") + std::strerror(errno));
+        }
+
+        for (size_t i = 1; i < fds.size(); ++i)
+            if (fds[i].revents & (POLLIN | POLLERR)) handleUpstream(fds[i].fd);
+        if (fds[0].revents & POLLIN) handleQuery();
+        expirePending();
+    }
+}
+
+void DNSServer::handleQuery() {
+    unsigned char query[MAX_PACKET];
+    sockaddr_in client;
+    socklen_t clientLength = sizeof(client);
+
+    ssize_t received = recvfrom(m_socket, query, sizeof(query), 0, reinterpret_cast<sockaddr*>(&client), &clientLength);
+    if (received < static_cast<ssize_t>(HEADER_LENGTH)) return;
+    size_t length = static_cast<size_t>(received);
+
+    // Ignore responses and anything that is not a single standard query
+    size_t end = questionEnd(query, length);
+    if ((query[2] & 0x80) != 0 || (query[2] & 0x78) != 0 || end == 0) return;
+
+    if (m_index) {
+        char name[256];
+        size_t nameLength{0};
+        size_t pos{HEADER_LENGTH};
+
+        while (query[pos] != 0) {
+            size_t label = query[pos];
+            if (nameLength > 0) name[nameLength++] = '.';
+            std::memcpy(name + nameLength, query + pos + 1, label);
+            nameLength += label;
+            pos += 1 + label;
+        }
+        foldCase(name, nameLength);
+
+        uint16_t qtype = read16(query + end - 4);
+        uint16_t qclass = read16(query + end - 2);
+        uint32_t ip;
+
+        if (qclass == CLASS_IN && m_index->lookup(name, nameLength, ip)) {
+            unsigned char reply[512];
+            if (end + 28 <= sizeof(reply)) {
+                size_t replyLength = answer(query, end, qtype, ip, reply);
+                sendto(m_socket, reply, replyLength, 0, reinterpret_cast<sockaddr*>(&client), clientLength);
+                return;
+            }
+        }
+    }
+
+    relay(query, length, end, client);
+}
+
+void DNSServer::relay(unsigned char *query, size_t length, size_t questionEnd, const sockaddr_in &client) {
+    if (m_pending.size() >= MAX_PENDING) return;
+
+    int upstream = openUpstreamSocket();
+    if (upstream < 0) return;
+
+    Pending pending;
+    pending.client = client;
+    pending.clientID = read16(query);
+    pending.upstreamID = random16();
+    pending.question.assign(reinterpret_cast<const char*>(query + HEADER_LENGTH), questionEnd - HEADER_LENGTH);
+    pending.deadline = now() + UPSTREAM_TIMEOUT_MS;
+
+    write16(query, pending.upstreamID);
+    if (send(upstream, query, length, 0) == static_cast<ssize_t>(length))
+        m_pending[upstream] = pending;
+    else
+        close(upstream);
+}
+
+void DNSServer::handleUpstream(int socket) {
+    auto pending = m_pending.find(socket);
+    if (pending == m_pending.end()) return;
+
+    unsigned char reply[MAX_PACKET];
+    ssize_t received = recv(socket, reply, sizeof(reply), 0);
+    if (received < static_cast<ssize_t>(HEADER_LENGTH)) return;
+    size_t length = static_cast<size_t>(received);
+
+    // Anything that isn't the answer to exactly this question is dropped, and
+    // the query stays pending in case the real answer is still on its way
+    const std::string &question = pending->second.question;
+    size_t end = questionEnd(reply, length);
+    if ((reply[2] & 0x80) == 0 || read16(reply) != pending->second.upstreamID ||
+            end != HEADER_LENGTH + question.length() ||
+            std::memcmp(reply + HEADER_LENGTH, question.data(), question.length()) != 0)
+        return;
+
+    write16(reply, pending->second.clientID);
+    sendto(m_socket, reply, length, 0,
+           reinterpret_cast<const sockaddr*>(&pending->second.client), sizeof(pending->second.client));
+    close(socket);
+    m_pending.erase(pending);
+}
+
+void DNSServer::expirePending() {
+    if (m_pending.empty()) return;
+
+    int64_t time = now();
+    for (auto it = m_pending.begin(); it != m_pending.end();) {
+        if (it->second.deadline < time) {
+            close(it->first);
+            it = m_pending.erase(it);
+        }
+        else ++it;
+    }
+}
+
+size_t DNSServer::answer(const unsigned char *query, size_t questionEnd, uint16_t qtype,
+                         uint32_t ip, unsigned char *reply) const {
+    std::memcpy(reply, query, questionEnd);
+
+    // QR, AA and the client's RD bit; RA, NOERROR
+    reply[2] = static_cast<unsigned char>(0x80 | 0x04 | (query[2] & 0x01));
+    reply[3] = 0x80;
+    write16(reply + 4, 1);
+    write16(reply + 6, 0);
+    write16(reply + 8, 0);
+    write16(reply + 10, 0);
+
+    unsigned char rdata[16];
+    uint16_t rdlength{0};
+
+    if (qtype == TYPE_A) {
+        std::memcpy(rdata, &ip, 4);
+        rdlength = 4;
+    }
+    else if (qtype == TYPE_AAAA) {
+        // Map the common sinkhole addresses onto their IPv6 equivalents;
+        // anything else gets an empty answer so the client uses the A record
+        if (ip == htonl(INADDR_LOOPBACK)) {
+            std::memset(rdata, 0, 16);
+            rdata[15] = 1;
+            rdlength = 16;
+        }
+        else if (ip == htonl(INADDR_ANY)) {
+            std::memset(rdata, 0, 16);
+            rdlength = 16;
+        }
+    }
+
+    size_t pos = questionEnd;
+    if (rdlength > 0) {
+        write16(reply + 6, 1);
+        write16(reply + pos, static_cast<uint16_t>(0xC000 | HEADER_LENGTH)); // Pointer to the question name
+        write16(reply + pos + 2, qtype);
+        write16(reply + pos + 4, CLASS_IN);
+        write16(reply + pos + 6, static_cast<uint16_t>(ANSWER_TTL >> 16));
+        write16(reply + pos + 8, static_cast<uint16_t>(ANSWER_TTL & 0xFFFF));
+        write16(reply + pos + 10, rdlength);
+        std::memcpy(reply + pos + 12, rdata, rdlength);
+        pos += 12 + rdlength;
+    }
+
+    return pos;
+}
@@ -0,0 +1,66 @@
+#ifndef DNSSERVER_H
+#define DNSSERVER_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <netinet/in.h>
+#include "domainindex.h"
+
+/*
+ * Minimal DNS sinkhole listening on 127.0.0.1.
+ * A and AAAA queries for names in the current DomainIndex are answered
+ * directly; every other query is relayed to the upstream server. Each relayed
+ * query gets its own socket on a random port and a random transaction ID, and
+ * only a reply carrying both and repeating the question is passed back.
+ * run() serves on the calling thread until stop() is called. update() may
+ * be called from any thread to swap in a freshly built index.
+ */
+class DNSServer
+{
+public:
+    DNSServer(uint16_t port, const std::string &upstreamIP, uint16_t upstreamPort = 53);
+    ~DNSServer();
+
+    void bind();
+    void run();
+    void stop();
+    void update(std::unique_ptr<DomainIndex> index);
+
+    uint16_t port() const;
+
+private:
+    struct Pending {
+        sockaddr_in client;
+        uint16_t clientID;
+        uint16_t upstreamID;
+        std::string question; // Name, type and class as sent upstream
+        int64_t deadline;
+    };
+
+    void handleQuery();
+    void relay(unsigned char *query, size_t length, size_t questionEnd, const sockaddr_in &client);
+    void handleUpstream(int socket);
+    void expirePending();
+    int openUpstreamSocket() const;
+    size_t answer(const unsigned char *query, size_t questionEnd, uint16_t qtype,
+                  uint32_t ip, unsigned char *reply) const;
+
+    static const int64_t UPSTREAM_TIMEOUT_MS;
+    static const uint32_t ANSWER_TTL;
+    static const size_t MAX_PENDING;
+
+    uint16_t m_port;
+    sockaddr_in m_upstream;
+    int m_socket{-1};
+
+    std::unique_ptr<DomainIndex> m_index;
+    std::atomic<DomainIndex*> m_nextIndex{nullptr};
+    std::atomic<bool> m_running{false};
+    // Relayed queries waiting for an answer, by the socket they were sent on
+    std::unordered_map<int, Pending> m_pending;
+};
+
+#endif // DNSSERVER_H
@@ -0,0 +1,93 @@
+#include <cstring>
+#include <arpa/inet.h>
+#include "domainindex.h"
+
+uint32_t DomainIndex::hash(const char *data, size_t length) {
+    // FNV-1a; never returns 0 so that 0 can mark an empty slot
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < length; ++i) {
+        h ^= static_cast<unsigned char>(data[i]);
+        h *= 16777619u;
+    }
+    return h == 0 ? 1 : h;
+}
+
+void DomainIndex::insert(const std::string &domain, const std::string &ip) {
+    in_addr addr;
+    if (domain.empty() || inet_pton(AF_INET, ip.c_str(), &addr) != 1) return;
+
+    Slot slot;
+    slot.hash = hash(domain.data(), domain.length());
+    slot.offset = static_cast<uint32_t>(m_names.length());
+    slot.length = static_cast<uint32_t>(domain.length());
+    slot.ip = addr.s_addr;
+
+    m_names.append(domain);
+    m_pending.push_back(slot);
+}
+
+void DomainIndex::build() {
+    // Keep the load factor at or below one half so probe sequences stay short
+    size_t capacity = 16;
+    while (capacity < m_pending.size() * 2) capacity <<= 1;
+
+    m_slots.assign(capacity, Slot());
+    m_mask = static_cast<uint32_t>(capacity - 1);
+    m_size = 0;
+
+    for (const Slot &slot : m_pending) {
+        uint32_t i = slot.hash & m_mask;
+        bool duplicate{false};
+        while (m_slots[i].hash != 0) {
+            if (m_slots[i].hash == slot.hash && m_slots[i].length == slot.length &&
+                    std::memcmp(m_names.data() + m_slots[i].offset, m_names.data() + slot.offset, slot.length) == 0) {
+                // First entry wins, as in HostsFile::insert
+                duplicate = true;
+                break;
+            }
+            i = (i + 1) & m_mask;
+        }
+        if (!duplicate) {
+            m_slots[i] = slot;
+            ++m_size;
+        }
+    }
+
+    m_pending.clear();
+    m_pending.shrink_to_fit();
+}
+
+void DomainIndex::setPatterns(std::unique_ptr<PatternMatcher> patterns, const std::string &ip) {
+    in_addr addr;
+    if (inet_pton(AF_INET, ip.c_str(), &addr) != 1) return;
+
+    m_patterns = std::move(patterns);
+    m_patternIP = addr.s_addr;
+}
+
+bool DomainIndex::lookup(const char *domain, size_t length, uint32_t &ip) const {
+    if (!m_slots.empty()) {
+        uint32_t h = hash(domain, length);
+        uint32_t i = h & m_mask;
+        while (m_slots[i].hash != 0) {
+            const Slot &slot = m_slots[i];
+            if (slot.hash == h && slot.length == length && std::memcmp(m_names.data() + slot.offset, domain, length) == 0) {
+                ip = slot.ip;
+                return true;
+            }
+            i = (i + 1) & m_mask;
+        }
+    }
+
+    if (m_patterns && m_patterns->matches(domain, length)) {
+        ip = m_patternIP;
+        return true;
+    }
+    return false;
+}
+
+bool DomainIndex::lookup(const std::string &domain, uint32_t &ip) const {
+    return lookup(domain.data(), domain.length(), ip);
+}
+
+size_t DomainIndex::size() const { return m_size; }
@@ -0,0 +1,49 @@
+#ifndef DOMAININDEX_H
+#define DOMAININDEX_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "patternmatcher.h"
+
+/*
+ * Read-only hash index from domain name to IPv4 address.
+ * Entries are added with insert() and the table is laid out by build();
+ * once built the index is never modified, so any number of readers may
+ * call lookup() concurrently without locking. Domains not in the table
+ * map to the pattern IP if they match a compiled blacklist pattern.
+ */
+class DomainIndex
+{
+public:
+    void insert(const std::string &domain, const std::string &ip);
+    void build();
+    void setPatterns(std::unique_ptr<PatternMatcher> patterns, const std::string &ip);
+
+    // ip is returned in network byte order
+    bool lookup(const char *domain, size_t length, uint32_t &ip) const;
+    bool lookup(const std::string &domain, uint32_t &ip) const;
+    size_t size() const;
+
+private:
+    struct Slot {
+        uint32_t hash{0};
+        uint32_t offset{0};
+        uint32_t length{0};
+        uint32_t ip{0};
+    };
+
+    static uint32_t hash(const char *data, size_t length);
+
+    std::string m_names;
+    std::vector<Slot> m_pending;
+    std::vector<Slot> m_slots;
+    uint32_t m_mask{0};
+    size_t m_size{0};
+
+    std::unique_ptr<PatternMatcher> m_patterns;
+    uint32_t m_patternIP{0};
+};
+
+#endif // DOMAININDEX_H
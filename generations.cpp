@@ -0,0 +1,131 @@
+#include <algorithm>
+#include <stdexcept>
+#include "generations.h"
+
+void GenerationWriter::add(const std::string &ip, const std::string &hostname) {
+    size_t prefix{0};
+    size_t limit = std::min(hostname.length(), m_hostname.length());
+    while (prefix < limit && hostname[prefix] == m_hostname[prefix]) ++prefix;
+
+    m_data += std::to_string(prefix);
+    m_data += ' ';
+    m_data.append(hostname, prefix, std::string::npos);
+    if (m_entries == 0 || ip != m_ip) {
+        m_data += ' ';
+        m_data += ip;
+        m_ip = ip;
+    }
+    m_data += '\n';
+
+    m_hostname = hostname;
+    ++m_entries;
+}
+
+const std::string& GenerationWriter::data() const { return m_data; }
+int GenerationWriter::entries() const { return m_entries; }
+
+GenerationReader::GenerationReader(const std::string &data): m_data{data} {}
+
+bool GenerationReader::next() {
+    if (m_pos >= m_data.length()) return false;
+
+    size_t end = m_data.find('\n', m_pos);
+    size_t space = m_data.find(' ', m_pos);
+    if (end == std::string::npos || space == std::string::npos || space > end)
+        throw std::runtime_error("Corrupt generation data");
+
+    size_t prefix{0};
+    for (size_t i = m_pos; i < space; ++i) {
+        char c = m_data[i];
+        if (c < '0' || c > '9') throw std::runtime_error("Corrupt generation data");
+        prefix = prefix * 10 + static_cast<size_t>(c - '0');
+    }
+    if (prefix > m_hostname.length()) throw std::runtime_error("Corrupt generation data");
+
+    size_t suffix = space + 1;
+    size_t ip = m_data.find(' ', suffix);
+    if (ip == std::string::npos || ip > end) ip = end;
+
+    m_hostname.resize(prefix);
+    m_hostname.append(m_data, suffix, ip - suffix);
+    if (ip < end) m_ip.assign(m_data, ip + 1, end - ip - 1);
+    else if (m_pos == 0) throw std::runtime_error("Corrupt generation data");
+
+    m_pos = end + 1;
+    return true;
+}
+
+const std::string& GenerationReader::ip() const { return m_ip; }
+const std::string& GenerationReader::hostname() const { return m_hostname; }
+
+void diffEntries(const std::string &from, const std::string &to,
+                 const std::function<void(const EntryChange &change)> &callback) {
+    GenerationReader older(from);
+    GenerationReader newer(to);
+    bool hasOlder = older.next();
+    bool hasNewer = newer.next();
+    EntryChange change;
+
+    while (hasOlder || hasNewer) {
+        int order = !hasOlder ? 1 : (!hasNewer ? -1 : older.hostname().compare(newer.hostname()));
+
+        if (order < 0) {
+            change.type = EntryChange::REMOVED;
+            change.hostname = older.hostname();
+            change.ip.clear();
+            change.oldIP = older.ip();
+            callback(change);
+            hasOlder = older.next();
+        }
+        else if (order > 0) {
+            change.type = EntryChange::ADDED;
+            change.hostname = newer.hostname();
+            change.ip = newer.ip();
+            change.oldIP.clear();
+            callback(change);
+            hasNewer = newer.next();
+        }
+        else {
+            if (older.ip() != newer.ip()) {
+                change.type = EntryChange::CHANGED;
+                change.hostname = newer.hostname();
+                change.ip = newer.ip();
+                change.oldIP = older.ip();
+                callback(change);
+            }
+            hasOlder = older.next();
+            hasNewer = newer.next();
+        }
+    }
+}
+
+void diffLines(const std::string &from, const std::string &to,
+               const std::function<void(bool added, const std::string &line)> &callback) {
+    size_t older{0}, newer{0};
+    std::string olderLine, newerLine;
+
+    while (older < from.length() || newer < to.length()) {
+        size_t olderEnd = from.find('\n', older);
+        size_t newerEnd = to.find('\n', newer);
+        if (olderEnd == std::string::npos) olderEnd = from.length();
+        if (newerEnd == std::string::npos) newerEnd = to.length();
+
+        int order;
+        if (older >= from.length()) order = 1;
+        else if (newer >= to.length()) order = -1;
+        else order = from.compare(older, olderEnd - older, to, newer, newerEnd - newer);
+
+        if (order < 0) {
+            callback(false, from.substr(older, olderEnd - older));
+            older = olderEnd + 1;
+        }
+        else if (order > 0) {
+            callback(true, to.substr(newer, newerEnd - newer));
+            newer = newerEnd + 1;
+        }
+        else {
+            older = olderEnd + 1;
+            newer = newerEnd + 1;
+        }
+    }
+}
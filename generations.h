@@ -0,0 +1,72 @@
+#ifndef GENERATIONS_H
+#define GENERATIONS_H
+
+#include <functional>
+#include <string>
+
+// One recorded output of the pipeline, see Config::recordGeneration()
+struct Generation {
+    int id{0};
+    long long created{0}; // Unix time
+    int entries{0};
+};
+
+/*
+ * Encodes a list of entries, sorted by hostname, as front-coded text: one
+ * line per entry, "<prefix> <suffix>[ <ip>]", where prefix is the number of
+ * bytes the hostname shares with the previous one and suffix is the rest of
+ * it. The IP address is only written when it differs from the previous
+ * entry's, which for a blocklist is almost never.
+ */
+class GenerationWriter
+{
+public:
+    // Hostnames must be added in strictly increasing order
+    void add(const std::string &ip, const std::string &hostname);
+
+    const std::string& data() const;
+    int entries() const;
+
+private:
+    std::string m_data;
+    std::string m_hostname;
+    std::string m_ip;
+    int m_entries{0};
+};
+
+// Decodes what GenerationWriter wrote, one entry at a time
+class GenerationReader
+{
+public:
+    explicit GenerationReader(const std::string &data);
+
+    // Move to the next entry; false at the end of the data.
+    // Throws std::runtime_error if the data is malformed.
+    bool next();
+    const std::string& ip() const;
+    const std::string& hostname() const;
+
+private:
+    const std::string &m_data;
+    size_t m_pos{0};
+    std::string m_hostname;
+    std::string m_ip;
+};
+
+struct EntryChange {
+    enum Type { ADDED, REMOVED, CHANGED } type;
+    std::string hostname;
+    std::string ip;    // The IP address in the newer generation, unless REMOVED
+    std::string oldIP; // The IP address in the older generation, unless ADDED
+};
+
+// Report every entry that differs between two encoded generations, in hostname
+// order, by merging them in a single pass
+void diffEntries(const std::string &from, const std::string &to,
+                 const std::function<void(const EntryChange &change)> &callback);
+
+// Report the lines only one of two sorted, newline-terminated texts contains
+void diffLines(const std::string &from, const std::string &to,
+               const std::function<void(bool added, const std::string &line)> &callback);
+
+#endif // GENERATIONS_H
@@ -0,0 +1,276 @@
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "hostname.h"
+
+static const size_t MAX_LABEL_LENGTH{63};
+
+// Punycode parameters, RFC 3492 section 5
+static const uint32_t BASE{36};
+static const uint32_t TMIN{1};
+static const uint32_t TMAX{26};
+static const uint32_t SKEW{38};
+static const uint32_t DAMP{700};
+static const uint32_t INITIAL_BIAS{72};
+static const uint32_t INITIAL_N{128};
+
+bool foldCase(char *text, size_t length) {
+    size_t i{0};
+    unsigned char seen{0};
+
+#ifdef __SSE2__
+    const __m128i beforeA = _mm_set1_epi8('A' - 1);
+    const __m128i afterZ = _mm_set1_epi8('Z' + 1);
+    const __m128i caseBit = _mm_set1_epi8(0x20);
+    int nonASCII{0};
+
+    for (; i + 16 <= length; i += 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + i));
+        // The comparisons are signed, so bytes >= 0x80 are never taken for letters
+        __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(chunk, beforeA), _mm_cmplt_epi8(chunk, afterZ));
+        chunk = _mm_or_si128(chunk, _mm_and_si128(upper, caseBit));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(text + i), chunk);
+        nonASCII |= _mm_movemask_epi8(chunk);
+    }
+    if (nonASCII != 0) seen = 0x80;
+#endif
+
+    for (; i < length; ++i) {
+        unsigned char c = static_cast<unsigned char>(text[i]);
+        if (c >= 'A' && c <= 'Z') text[i] = static_cast<char>(c | 0x20);
+        seen |= c;
+    }
+    return (seen & 0x80) != 0;
+}
+
+// Code points whose lower case is one other code point: every stride'th code
+// point from first to last maps to itself plus delta. Generated from the
+// Unicode 14.0 character database (Python's str.lower()).
+struct CaseRange {
+    uint32_t first;
+    uint32_t last;
+    uint32_t stride;
+    int32_t delta;
+};
+
+static const CaseRange LOWER_CASE[]{
+    {0x00C0, 0x00D6, 1, 32}, {0x00D8, 0x00DE, 1, 32}, {0x0100, 0x012E, 2, 1}, {0x0132, 0x0136, 2, 1},
+    {0x0139, 0x0147, 2, 1}, {0x014A, 0x0176, 2, 1}, {0x0178, 0x0178, 1, -121}, {0x0179, 0x017D, 2, 1},
+    {0x0181, 0x0181, 1, 210}, {0x0182, 0x0184, 2, 1}, {0x0186, 0x0186, 1, 206}, {0x0187, 0x0187, 1, 1},
+    {0x0189, 0x018A, 1, 205}, {0x018B, 0x018B, 1, 1}, {0x018E, 0x018E, 1, 79}, {0x018F, 0x018F, 1, 202},
+    {0x0190, 0x0190, 1, 203}, {0x0191, 0x0191, 1, 1}, {0x0193, 0x0193, 1, 205}, {0x0194, 0x0194, 1, 207},
+    {0x0196, 0x0196, 1, 211}, {0x0197, 0x0197, 1, 209}, {0x0198, 0x0198, 1, 1}, {0x019C, 0x019C, 1, 211},
+    {0x019D, 0x019D, 1, 213}, {0x019F, 0x019F, 1, 214}, {0x01A0, 0x01A4, 2, 1}, {0x01A6, 0x01A6, 1, 218},
+    {0x01A7, 0x01A7, 1, 1}, {0x01A9, 0x01A9, 1, 218}, {0x01AC, 0x01AC, 1, 1}, {0x01AE, 0x01AE, 1, 218},
+    {0x01AF, 0x01AF, 1, 1}, {0x01B1, 0x01B2, 1, 217}, {0x01B3, 0x01B5, 2, 1}, {0x01B7, 0x01B7, 1, 219},
+    {0x01B8, 0x01B8, 1, 1}, {0x01BC, 0x01BC, 1, 1}, {0x01C4, 0x01C4, 1, 2}, {0x01C5, 0x01C5, 1, 1},
+    {0x01C7, 0x01C7, 1, 2}, {0x01C8, 0x01C8, 1, 1}, {0x01CA, 0x01CA, 1, 2}, {0x01CB, 0x01DB, 2, 1},
+    {0x01DE, 0x01EE, 2, 1}, {0x01F1, 0x01F1, 1, 2}, {0x01F2, 0x01F4, 2, 1}, {0x01F6, 0x01F6, 1, -97},
+    {0x01F7, 0x01F7, 1, -56}, {0x01F8, 0x021E, 2, 1}, {0x0220, 0x0220, 1, -130}, {0x0222, 0x0232, 2, 1},
+    {0x023A, 0x023A, 1, 10795}, {0x023B, 0x023B, 1, 1}, {0x023D, 0x023D, 1, -163}, {0x023E, 0x023E, 1, 10792},
+    {0x0241, 0x0241, 1, 1}, {0x0243, 0x0243, 1, -195}, {0x0244, 0x0244, 1, 69}, {0x0245, 0x0245, 1, 71},
+    {0x0246, 0x024E, 2, 1}, {0x0370, 0x0372, 2, 1}, {0x0376, 0x0376, 1, 1}, {0x037F, 0x037F, 1, 116},
+    {0x0386, 0x0386, 1, 38}, {0x0388, 0x038A, 1, 37}, {0x038C, 0x038C, 1, 64}, {0x038E, 0x038F, 1, 63},
+    {0x0391, 0x03A1, 1, 32}, {0x03A3, 0x03AB, 1, 32}, {0x03CF, 0x03CF, 1, 8}, {0x03D8, 0x03EE, 2, 1},
+    {0x03F4, 0x03F4, 1, -60}, {0x03F7, 0x03F7, 1, 1}, {0x03F9, 0x03F9, 1, -7}, {0x03FA, 0x03FA, 1, 1},
+    {0x03FD, 0x03FF, 1, -130}, {0x0400, 0x040F, 1, 80}, {0x0410, 0x042F, 1, 32}, {0x0460, 0x0480, 2, 1},
+    {0x048A, 0x04BE, 2, 1}, {0x04C0, 0x04C0, 1, 15}, {0x04C1, 0x04CD, 2, 1}, {0x04D0, 0x052E, 2, 1},
+    {0x0531, 0x0556, 1, 48}, {0x10A0, 0x10C5, 1, 7264}, {0x10C7, 0x10C7, 1, 7264}, {0x10CD, 0x10CD, 1, 7264},
+    {0x13A0, 0x13EF, 1, 38864}, {0x13F0, 0x13F5, 1, 8}, {0x1C90, 0x1CBA, 1, -3008}, {0x1CBD, 0x1CBF, 1, -3008},
+    {0x1E00, 0x1E94, 2, 1}, {0x1E9E, 0x1E9E, 1, -7615}, {0x1EA0, 0x1EFE, 2, 1}, {0x1F08, 0x1F0F, 1, -8},
+    {0x1F18, 0x1F1D, 1, -8}, {0x1F28, 0x1F2F, 1, -8}, {0x1F38, 0x1F3F, 1, -8}, {0x1F48, 0x1F4D, 1, -8},
+    {0x1F59, 0x1F5F, 2, -8}, {0x1F68, 0x1F6F, 1, -8}, {0x1F88, 0x1F8F, 1, -8}, {0x1F98, 0x1F9F, 1, -8},
+    {0x1FA8, 0x1FAF, 1, -8}, {0x1FB8, 0x1FB9, 1, -8}, {0x1FBA, 0x1FBB, 1, -74}, {0x1FBC, 0x1FBC, 1, -9},
+    {0x1FC8, 0x1FCB, 1, -86}, {0x1FCC, 0x1FCC, 1, -9}, {0x1FD8, 0x1FD9, 1, -8}, {0x1FDA, 0x1FDB, 1, -100},
+    {0x1FE8, 0x1FE9, 1, -8}, {0x1FEA, 0x1FEB, 1, -112}, {0x1FEC, 0x1FEC, 1, -7}, {0x1FF8, 0x1FF9, 1, -128},
+    {0x1FFA, 0x1FFB, 1, -126}, {0x1FFC, 0x1FFC, 1, -9}, {0x2126, 0x2126, 1, -7517}, {0x212A, 0x212A, 1, -8383},
+    {0x212B, 0x212B, 1, -8262}, {0x2132, 0x2132, 1, 28}, {0x2160, 0x216F, 1, 16}, {0x2183, 0x2183, 1, 1},
+    {0x24B6, 0x24CF, 1, 26}, {0x2C00, 0x2C2F, 1, 48}, {0x2C60, 0x2C60, 1, 1}, {0x2C62, 0x2C62, 1, -10743},
+    {0x2C63, 0x2C63, 1, -3814}, {0x2C64, 0x2C64, 1, -10727}, {0x2C67, 0x2C6B, 2, 1},
+    {0x2C6D, 0x2C6D, 1, -10780}, {0x2C6E, 0x2C6E, 1, -10749}, {0x2C6F, 0x2C6F, 1, -10783},
+    {0x2C70, 0x2C70, 1, -10782}, {0x2C72, 0x2C72, 1, 1}, {0x2C75, 0x2C75, 1, 1}, {0x2C7E, 0x2C7F, 1, -10815},
+    {0x2C80, 0x2CE2, 2, 1}, {0x2CEB, 0x2CED, 2, 1}, {0x2CF2, 0x2CF2, 1, 1}, {0xA640, 0xA66C, 2, 1},
+    {0xA680, 0xA69A, 2, 1}, {0xA722, 0xA72E, 2, 1}, {0xA732, 0xA76E, 2, 1}, {0xA779, 0xA77B, 2, 1},
+    {0xA77D, 0xA77D, 1, -35332}, {0xA77E, 0xA786, 2, 1}, {0xA78B, 0xA78B, 1, 1}, {0xA78D, 0xA78D, 1, -42280},
+    {0xA790, 0xA792, 2, 1}, {0xA796, 0xA7A8, 2, 1}, {0xA7AA, 0xA7AA, 1, -42308}, {0xA7AB, 0xA7AB, 1, -42319},
+    {0xA7AC, 0xA7AC, 1, -42315}, {0xA7AD, 0xA7AD, 1, -42305}, {0xA7AE, 0xA7AE, 1, -42308},
+    {0xA7B0, 0xA7B0, 1, -42258}, {0xA7B1, 0xA7B1, 1, -42282}, {0xA7B2, 0xA7B2, 1, -42261},
+    {0xA7B3, 0xA7B3, 1, 928}, {0xA7B4, 0xA7C2, 2, 1}, {0xA7C4, 0xA7C4, 1, -48}, {0xA7C5, 0xA7C5, 1, -42307},
+    {0xA7C6, 0xA7C6, 1, -35384}, {0xA7C7, 0xA7C9, 2, 1}, {0xA7D0, 0xA7D0, 1, 1}, {0xA7D6, 0xA7D8, 2, 1},
+    {0xA7F5, 0xA7F5, 1, 1}, {0xFF21, 0xFF3A, 1, 32}, {0x10400, 0x10427, 1, 40}, {0x104B0, 0x104D3, 1, 40},
+    {0x10570, 0x1057A, 1, 39}, {0x1057C, 0x1058A, 1, 39}, {0x1058C, 0x10592, 1, 39}, {0x10594, 0x10595, 1, 39},
+    {0x10C80, 0x10CB2, 1, 64}, {0x118A0, 0x118BF, 1, 32}, {0x16E40, 0x16E5F, 1, 32}, {0x1E900, 0x1E921, 1, 34},
+};
+
+// The one capital whose lower case is two code points (i and a combining dot)
+static const uint32_t CAPITAL_I_WITH_DOT{0x130};
+
+// Returns false if codePoint has no single code point lower case
+static bool lowerCase(uint32_t &codePoint) {
+    if (codePoint < 0x80) {
+        if (codePoint >= 'A' && codePoint <= 'Z') codePoint |= 0x20;
+        return true;
+    }
+    if (codePoint == CAPITAL_I_WITH_DOT) return false;
+
+    const CaseRange *end = LOWER_CASE + sizeof(LOWER_CASE) / sizeof(LOWER_CASE[0]);
+    const CaseRange *range = std::lower_bound(LOWER_CASE, end, codePoint, [](const CaseRange &range, uint32_t codePoint) -> bool {
+        return range.last < codePoint;
+    });
+    if (range != end && codePoint >= range->first && (codePoint - range->first) % range->stride == 0)
+        codePoint = static_cast<uint32_t>(static_cast<int32_t>(codePoint) + range->delta);
+    return true;
+}
+
+static bool decodeUTF8(const std::string &text, size_t start, size_t end, std::vector<uint32_t> &codePoints) {
+    codePoints.clear();
+    size_t i{start};
+    while (i < end) {
+        unsigned char lead = static_cast<unsigned char>(text[i]);
+        uint32_t codePoint;
+        size_t extra;
+        if (lead < 0x80) { codePoint = lead; extra = 0; }
+        else if (lead >= 0xC2 && lead <= 0xDF) { codePoint = lead & 0x1F; extra = 1; }
+        else if (lead >= 0xE0 && lead <= 0xEF) { codePoint = lead & 0x0F; extra = 2; }
+        else if (lead >= 0xF0 && lead <= 0xF4) { codePoint = lead & 0x07; extra = 3; }
+        else return false;
+
+        if (end - i <= extra) return false;
+        for (size_t j = 1; j <= extra; ++j) {
+            unsigned char next = static_cast<unsigned char>(text[i + j]);
+            if ((next & 0xC0) != 0x80) return false;
+            codePoint = (codePoint << 6) | (next & 0x3F);
+        }
+
+        // Overlong forms, surrogates and anything past Unicode
+        if ((extra == 2 && codePoint < 0x800) || (extra == 3 && codePoint < 0x10000) ||
+                (codePoint >= 0xD800 && codePoint <= 0xDFFF) || codePoint > 0x10FFFF)
+            return false;
+
+        codePoints.push_back(codePoint);
+        i += extra + 1;
+    }
+    return true;
+}
+
+static uint32_t adapt(uint32_t delta, uint32_t points, bool first) {
+    delta = first ? delta / DAMP : delta / 2;
+    delta += delta / points;
+
+    uint32_t k{0};
+    while (delta > ((BASE - TMIN) * TMAX) / 2) {
+        delta /= BASE - TMIN;
+        k += BASE;
+    }
+    return k + (BASE - TMIN + 1) * delta / (delta + SKEW);
+}
+
+static char digit(uint32_t value) {
+    return static_cast<char>(value < 26 ? 'a' + value : '0' + value - 26);
+}
+
+// RFC 3492 section 6.3, without the optional case annotations
+// Appends to output
+static bool punycode(const std::vector<uint32_t> &input, std::string &output) {
+    uint32_t basic{0};
+    for (uint32_t codePoint : input) {
+        if (codePoint < 0x80) {
+            output += static_cast<char>(codePoint);
+            ++basic;
+        }
+    }
+    uint32_t handled{basic};
+    if (basic > 0) output += '-';
+
+    uint32_t n{INITIAL_N};
+    uint32_t delta{0};
+    uint32_t bias{INITIAL_BIAS};
+
+    while (handled < input.size()) {
+        uint32_t next{UINT32_MAX};
+        for (uint32_t codePoint : input)
+            if (codePoint >= n && codePoint < next) next = codePoint;
+
+        if (next - n > (UINT32_MAX - delta) / (handled + 1)) return false;
+        delta += (next - n) * (handled + 1);
+        n = next;
+
+        for (uint32_t codePoint : input) {
+            if (codePoint < n && ++delta == 0) return false;
+            if (codePoint != n) continue;
+
+            uint32_t q{delta};
+            for (uint32_t k = BASE; ; k += BASE) {
+                uint32_t t = k <= bias ? TMIN : (k >= bias + TMAX ? TMAX : k - bias);
+                if (q < t) break;
+                output += digit(t + (q - t) % (BASE - t));
+                q = (q - t) / (BASE - t);
+            }
+            output += digit(q);
+            bias = adapt(delta, handled + 1, handled == basic);
+            delta = 0;
+            ++handled;
+
+            // Labels are capped at 63 bytes anyway, so give up early on huge input
+            if (output.length() > MAX_LABEL_LENGTH) return false;
+        }
+        ++delta;
+        ++n;
+    }
+    return true;
+}
+
+bool encodeIDN(std::string &hostname) {
+    std::string encoded;
+    std::vector<uint32_t> codePoints;
+    encoded.reserve(hostname.length() + 16);
+
+    size_t start{0};
+    while (start <= hostname.length()) {
+        size_t end = hostname.find('.', start);
+        if (end == std::string::npos) end = hostname.length();
+
+        bool ascii{true};
+        for (size_t i = start; i < end && ascii; ++i)
+            ascii = static_cast<unsigned char>(hostname[i]) < 0x80;
+
+        if (ascii) {
+            encoded.append(hostname, start, end - start);
+        }
+        else {
+            // Resolvers only ever ask for the A-label of the lower case form
+            if (!decodeUTF8(hostname, start, end, codePoints)) return false;
+            for (uint32_t &codePoint : codePoints)
+                if (!lowerCase(codePoint)) return false;
+
+            std::string label;
+            if (std::all_of(codePoints.begin(), codePoints.end(), [](uint32_t codePoint) -> bool { return codePoint < 0x80; })) {
+                // Such as the Kelvin sign, which folds to k
+                for (uint32_t codePoint : codePoints) label += static_cast<char>(codePoint);
+            }
+            else {
+                label = "xn--";
+                if (!punycode(codePoints, label) || label.length() > MAX_LABEL_LENGTH) return false;
+            }
+            encoded += label;
+        }
+
+        if (end < hostname.length()) encoded += '.';
+        start = end + 1;
+    }
+
+    hostname.swap(encoded);
+    return true;
+}
+
+bool normalizeHostname(std::string &hostname) {
+    bool ascii = !foldCase(&hostname[0], hostname.length());
+
+    size_t length = hostname.find_last_not_of('.');
+    hostname.resize(length == std::string::npos ? 0 : length + 1);
+
+    return ascii || encodeIDN(hostname);
+}
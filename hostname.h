@@ -0,0 +1,26 @@
+#ifndef HOSTNAME_H
+#define HOSTNAME_H
+
+#include <cstddef>
+#include <string>
+
+/*
+ * Hostname normalization, so that Example.COM, example.com. and example.com
+ * are stored, deduplicated and matched as the same name.
+ */
+
+// Lower-case the ASCII letters in text, in place.
+// Returns true if text contains any non-ASCII byte.
+bool foldCase(char *text, size_t length);
+
+// Replace every label of hostname that isn't ASCII with the IDNA form of its
+// lower case ("xn--" followed by the label's Punycode, RFC 3492), in place.
+// Returns false if a label isn't valid UTF-8, holds a capital whose lower case
+// is more than one code point (U+0130) or ends up longer than 63 bytes.
+bool encodeIDN(std::string &hostname);
+
+// Fold case, strip trailing dots and encode IDN labels.
+// Returns false if hostname can't be encoded, see encodeIDN().
+bool normalizeHostname(std::string &hostname);
+
+#endif // HOSTNAME_H
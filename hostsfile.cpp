@@ -17,14 +17,12 @@ HostsFile::HostsFile(): SQLite::DB(":memory:")
 
 HostsFile::~HostsFile() { close(); }
 
-void HostsFile::saveToFile(const std::string &loc) {
+void HostsFile::writeFile(const std::string &loc, const std::function<void(const EntryCallback &write)> &entries) {
     std::ofstream hosts(loc);
 
     if (hosts.fail())
         throw std::invalid_argument(loc);
 
-    SQLite::Stmt select = prepare("SELECT ip, hostname FROM entries ORDER BY hostname ASC");
-
     // Banner message at top
     hosts << "#####################################################################\n"
              "# This file was automatically generated by ShadowHosts by Shadow53. #\n"
@@ -35,13 +33,8 @@ void HostsFile::saveToFile(const std::string &loc) {
              "\n"
              "127.0.0.1 localhost localhost.localdomain\n";
 
-    select.exec([&hosts](SQLite::Row &row) mutable -> void {
-        try {
-            hosts << row.getString(0) << ' ' << row.getString(1) << '\n';
-        }
-        catch (SQLite::except::SQLiteError &e) {
-            //Halp
-        }
+    entries([&hosts](const std::string &ip, const std::string &hostname) -> void {
+        hosts << ip << ' ' << hostname << '\n';
     });
 
     hosts.close();
@@ -50,6 +43,12 @@ void HostsFile::saveToFile(const std::string &loc) {
         throw std::invalid_argument("An error occurred while closing the file.");
 }
 
+void HostsFile::saveToFile(const std::string &loc) {
+    writeFile(loc, [this](const EntryCallback &write) -> void {
+        forEach(write);
+    });
+}
+
 void HostsFile::insert(const std::string &ip, const std::string &hostname) {
     try {
         SQLite::Stmt insert = prepare("INSERT INTO entries(ip, hostname) VALUES(:ip, :host)");
@@ -75,3 +74,13 @@ void HostsFile::remove(const std::string &hostname) {
     remove.bindValue(":host", hostname);
     remove.exec();
 }
+
+void HostsFile::forEach(const EntryCallback &callback) {
+    SQLite::Stmt select = prepare("SELECT ip, hostname FROM entries ORDER BY hostname ASC");
+    std::string ip, hostname;
+    select.exec([&callback, &ip, &hostname](SQLite::Row &row) mutable -> void {
+        ip = row.getString(0);
+        hostname = row.getString(1);
+        callback(ip, hostname);
+    });
+}
@@ -2,18 +2,26 @@
 #define HOSTSFILE_H
 
 #include <string>
+#include <functional>
 #include <sqlite++/db.hpp>
 
 class HostsFile: private SQLite::DB
 {
 public:
+    typedef std::function<void(const std::string &ip, const std::string &hostname)> EntryCallback;
+
     HostsFile();
     ~HostsFile();
 
+    // Write a hosts file with the entries that entries() passes to its argument,
+    // without collecting them first. Throws std::invalid_argument if loc can't be written.
+    static void writeFile(const std::string &loc, const std::function<void(const EntryCallback &write)> &entries);
+
     void saveToFile(const std::string &loc);
     void insert(const std::string &ip, const std::string &hostname);
     void replace(const std::string &ip, const std::string &hostname);
     void remove(const std::string &hostname);
+    void forEach(const EntryCallback &callback);
 };
 
 #endif // HOSTSFILE_H
@@ -1,12 +1,17 @@
 #include <iostream>
+#include <iomanip>
 #include <cstdio>
+#include <ctime>
 #include <regex>
 #include <fstream>
-#include <sqlite++/db.hpp>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <thread>
 #include <sqlite++/exception.hpp>
-#include <curl/curl.h>
-#include "config.h"
-#include "hostsfile.h"
+#include "pipeline.h"
+#include "hostname.h"
+#include "dnsserver.h"
 
 /*
  * Also: Custom config db, verbose, disable whitelist/blacklist/redirect
@@ -20,14 +25,38 @@ static const std::string ARG_ENABLE{"--enable"};
 static const std::string ARG_DISABLE{"--disable"};
 static const std::string ARG_WHITELIST{"--whitelist"};
 static const std::string ARG_BLACKLIST{"--blacklist"};
+static const std::string ARG_BLACKLIST_PATTERN{"--blacklist-pattern"};
 static const std::string ARG_REDIRECT{"--redirect"};
 static const std::string ARG_HOSTS_SRC{"--hosts-src"};
 static const std::string ARG_ADD{"--add"};
 static const std::string ARG_REMOVE{"--remove"};
+static const std::string ARG_SERVE{"--serve"};
+static const std::string ARG_UPSTREAM{"--upstream"};
+static const std::string ARG_REFRESH_INTERVAL{"--refresh-interval"};
+static const std::string ARG_LIST_SOURCES{"--list-sources"};
+static const std::string ARG_LIST_GENERATIONS{"--list-generations"};
+static const std::string ARG_ROLLBACK{"--rollback"};
+static const std::string ARG_DIFF_GENERATION{"--diff-generation"};
+static const std::string ARG_KEEP_GENERATIONS{"--keep-generations"};
 
 static const std::string dbFileName{"config.db"};
 static const std::string redirectIPParam{"[IP_ADDRESS]"};
 
+static std::atomic<bool> serving{false};
+
+// The settings given on the command line that decide what main() does
+struct RunOptions {
+    std::string outFile;
+    std::string upstreamDNS;
+    int upstreamPort{53};
+    int servePort{-1};
+    int refreshInterval{86400};
+    bool listSources{false};
+    bool listGenerations{false};
+    int rollbackGeneration{0};
+    std::pair<int, int> diffGenerations{0, 0};
+};
+
 void printHelp(char *exeName) {
     std::cout << "Usage: " << exeName << " [CONFIG] [...]\n" <<
                  "\n" <<
@@ -35,7 +64,18 @@ void printHelp(char *exeName) {
                  ARG_REDIR_IP << " [IP_ADDRESS] Use the provided IP address for blacklist entries.\n" <<
                  std::string(ARG_REDIR_IP.length() + 14, ' ') << "If omitted, defaults to 127.0.0.1.\n" <<
                  ARG_OUT_FILE << " [FILE] Generate a hosts file and output to this location.\n" <<
+                 ARG_SERVE << " [PORT] Answer DNS queries on 127.0.0.1:[PORT] using the blocklist instead of a hosts file.\n" <<
+                 ARG_UPSTREAM << " [IP_ADDRESS[:PORT]] Forward queries for unblocked domains to this DNS server.\n" <<
+                 ARG_REFRESH_INTERVAL << " [SECONDS] While serving, download the hosts sources again this often.\n" <<
+                 std::string(ARG_REFRESH_INTERVAL.length() + 11, ' ') << "Use 0 to only download once at startup. Defaults to 86400.\n" <<
                  ARG_RESET << " Reset the configuration database to default.\n" <<
+                 ARG_LIST_SOURCES << " List the hosts sources with their index numbers and download history.\n" <<
+                 ARG_LIST_GENERATIONS << " List the stored generations, the outputs of the last runs with " << ARG_OUT_FILE << ".\n" <<
+                 ARG_ROLLBACK << " [GENERATION] With " << ARG_OUT_FILE << ", write the stored generation instead of downloading\n" <<
+                 std::string(ARG_ROLLBACK.length(), ' ') << " the hosts sources. The configuration database is left as it is.\n" <<
+                 ARG_DIFF_GENERATION << " [GENERATION] [GENERATION] Show what changed between two stored generations.\n" <<
+                 ARG_KEEP_GENERATIONS << " [N] Keep the last N generations, dropping older ones. Saved in the configuration\n" <<
+                 std::string(ARG_KEEP_GENERATIONS.length(), ' ') << " database. Defaults to 10.\n" <<
                  ARG_ADD << " [OPTION] [ARG] [...] Add the following entries to the configuration database (default).\n" <<
                  ARG_REMOVE << " [OPTION] [ARG] [...] Remove the following entries from the configuration database.\n" <<
                  ARG_ENABLE << " [OPTION] [INDEX] Enable the following item by index number, if disabled.\n" <<
@@ -47,6 +87,9 @@ void printHelp(char *exeName) {
                  "Whether the option is added or removed is determined by whether " << ARG_ADD << " or " << ARG_REMOVE << "\n" <<
                  "is nearest to the left of the option.\n\n" <<
                  ARG_BLACKLIST << " [DOMAIN] (Un)blacklist the given domain.\n" <<
+                 ARG_BLACKLIST_PATTERN << " [PATTERN] (Un)blacklist every domain matching the pattern. Patterns starting\n" <<
+                 std::string(ARG_BLACKLIST_PATTERN.length(), ' ') << " with ^ are regular expressions, e.g. ^track[0-9]+\\. ; anything else is\n" <<
+                 std::string(ARG_BLACKLIST_PATTERN.length(), ' ') << " a glob matching the whole domain, e.g. *.doubleclick.net or ads*.example.com\n" <<
                  ARG_WHITELIST << " [DOMAIN] (Un)whitelist the given domain (Prevents the domain from being blocked).\n" <<
                  ARG_REDIRECT << " (with " + ARG_ADD + ") [DOMAIN] [IP_ADDRESS] Redirect the given domain to the given IP address.\n" <<
                  std::string(ARG_REDIRECT.length(), ' ') << " (with " + ARG_REMOVE + ") [DOMAIN] Remove the redirection for the given domain.\n" <<
@@ -56,9 +99,21 @@ void printHelp(char *exeName) {
     std::exit(0); // Cleans up
 }
 
-bool configure(Config &config, int argc, char *argv[]) {
+static int parseGeneration(const std::string &arg) {
+    int generation;
+    try {
+        generation = std::stoi(arg);
+    }
+    catch (std::logic_error &e) {
+        throw std::invalid_argument("Could not convert \"" + arg + "\" to a generation number");
+    }
+    if (generation <= 0)
+        throw std::invalid_argument(arg + " is not a valid generation number!");
+    return generation;
+}
+
+bool configure(Config &config, RunOptions &options, int argc, char *argv[]) {
     try {
-        config.prepare();
         if (argc > 1) {
             bool removing{false};
             std::string arg;
@@ -79,6 +134,39 @@ bool configure(Config &config, int argc, char *argv[]) {
                 else if (arg == ARG_RESET) {
                     config.resetDB();
                 }
+                else if (arg == ARG_LIST_SOURCES) {
+                    options.listSources = true;
+                }
+                else if (arg == ARG_LIST_GENERATIONS) {
+                    options.listGenerations = true;
+                }
+                else if (arg == ARG_ROLLBACK) {
+                    if (i+1 < argc) options.rollbackGeneration = parseGeneration(argv[++i]);
+                    else throw std::invalid_argument("Missing argument [GENERATION] to flag " + ARG_ROLLBACK);
+                }
+                else if (arg == ARG_DIFF_GENERATION) {
+                    if (i+2 < argc) {
+                        int from = parseGeneration(argv[++i]);
+                        options.diffGenerations = std::make_pair(from, parseGeneration(argv[++i]));
+                    }
+                    else throw std::invalid_argument("Missing one or more of arguments [GENERATION] [GENERATION] to flag " + ARG_DIFF_GENERATION);
+                }
+                else if (arg == ARG_KEEP_GENERATIONS) {
+                    if (i+1 < argc) {
+                        arg = argv[++i];
+                        int count;
+                        try {
+                            count = std::stoi(arg);
+                        }
+                        catch (std::logic_error &e) {
+                            throw std::invalid_argument("Could not convert \"" + arg + "\" to a number of generations");
+                        }
+                        if (count <= 0)
+                            throw std::invalid_argument(arg + " is not a valid number of generations!");
+                        config.generationsKept(count);
+                    }
+                    else throw std::invalid_argument("Missing argument [N] to flag " + ARG_KEEP_GENERATIONS);
+                }
                 else if (arg == ARG_REMOVE) {
                     removing = true;
                 }
@@ -100,9 +188,25 @@ bool configure(Config &config, int argc, char *argv[]) {
                             }
                             config.toggleHostsSource(index, arg == ARG_ENABLE);
                         }
-                        else if (option == ARG_BLACKLIST) config.toggleBlacklist(optionArg, arg == ARG_ENABLE);
-                        else if (option == ARG_WHITELIST) config.toggleWhitelist(optionArg, arg == ARG_ENABLE);
-                        else if (option == ARG_REDIRECT) config.toggleRedirect(optionArg, arg == ARG_ENABLE);
+                        else if (option == ARG_BLACKLIST_PATTERN) {
+                            // Like removal, also reach patterns stored before they were normalized
+                            config.toggleBlacklistPattern(optionArg, arg == ARG_ENABLE);
+                            std::string pattern{optionArg};
+                            try {
+                                PatternMatcher::normalize(pattern);
+                                if (pattern != optionArg) config.toggleBlacklistPattern(pattern, arg == ARG_ENABLE);
+                            }
+                            catch (std::invalid_argument &e) {
+                                // Then it can't have been stored normalized either
+                            }
+                        }
+                        else {
+                            // Stored domains are normalized, see Config::prepare()
+                            normalizeHostname(optionArg);
+                            if (option == ARG_BLACKLIST) config.toggleBlacklist(optionArg, arg == ARG_ENABLE);
+                            else if (option == ARG_WHITELIST) config.toggleWhitelist(optionArg, arg == ARG_ENABLE);
+                            else if (option == ARG_REDIRECT) config.toggleRedirect(optionArg, arg == ARG_ENABLE);
+                        }
 
                     }
                     else throw std::invalid_argument("Missing one or more of arguments [OPTION] [INDEX] to flag " + arg);
@@ -110,6 +214,7 @@ bool configure(Config &config, int argc, char *argv[]) {
                 else if (arg == ARG_BLACKLIST) {
                     if (i+1 < argc) {
                         arg = argv[++i];
+                        normalizeHostname(arg);
                         if (removing) {
                             config.rmBlacklist(arg);
                         }
@@ -123,9 +228,33 @@ bool configure(Config &config, int argc, char *argv[]) {
                     }
                     else throw std::invalid_argument("Missing argument [DOMAIN] to flag " + ARG_BLACKLIST);
                 }
+                else if (arg == ARG_BLACKLIST_PATTERN) {
+                    if (i+1 < argc) {
+                        arg = argv[++i];
+                        std::string pattern{arg};
+                        if (removing) {
+                            // Patterns stored before they were normalized are removed as given
+                            config.rmBlacklistPattern(arg);
+                            try {
+                                PatternMatcher::normalize(pattern);
+                                if (pattern != arg) config.rmBlacklistPattern(pattern);
+                            }
+                            catch (std::invalid_argument &e) {
+                                // Then it can't have been stored normalized either
+                            }
+                        }
+                        else {
+                            // Both throw std::invalid_argument describing what is wrong with the pattern
+                            PatternMatcher::normalize(pattern);
+                            config.blacklistPattern(pattern);
+                        }
+                    }
+                    else throw std::invalid_argument("Missing argument [PATTERN] to flag " + ARG_BLACKLIST_PATTERN);
+                }
                 else if (arg == ARG_WHITELIST) {
                     if (i+1 < argc) {
                         arg = argv[++i];
+                        normalizeHostname(arg);
                         if (removing) {
                             config.rmWhitelist(arg);
                         }
@@ -143,6 +272,7 @@ bool configure(Config &config, int argc, char *argv[]) {
                     if (removing) {
                         if (i+1 < argc) {
                             arg = argv[++i];
+                            normalizeHostname(arg);
                             config.rmRedirect(arg);
                         }
                         else throw std::invalid_argument("Missing argument [DOMAIN] to flags " + ARG_REMOVE + " " + ARG_REDIRECT);
@@ -152,7 +282,7 @@ bool configure(Config &config, int argc, char *argv[]) {
                             std::string domain, ip;
                             domain = argv[++i];
                             ip = argv[++i];
-                            if (!std::regex_match(domain, Config::domainRegex))
+                            if (!normalizeHostname(domain) || !std::regex_match(domain, Config::domainRegex))
                                 throw std::invalid_argument(domain + " is not a valid domain name!");
                             else if (!std::regex_match(ip, Config::ipRegex))
                                 throw std::invalid_argument(ip + " is not a valid IP address!");
@@ -180,18 +310,76 @@ bool configure(Config &config, int argc, char *argv[]) {
                 else if (arg == ARG_OUT_FILE) {
                     if (i+1 < argc) {
                         arg = argv[++i];
-                        config.outFile(arg);
+                        options.outFile = arg;
                         // TODO: Check if valid file, can write, etc?
                     }
                     else throw std::invalid_argument("Missing argument [FILE] to flag " + ARG_OUT_FILE);
                 }
+                else if (arg == ARG_SERVE) {
+                    if (i+1 < argc) {
+                        arg = argv[++i];
+                        int port;
+                        try {
+                            port = std::stoi(arg);
+                        }
+                        catch (std::logic_error &e) {
+                            throw std::invalid_argument("Could not convert \"" + arg + "\" to a port number");
+                        }
+                        if (port < 0 || port > 65535)
+                            throw std::invalid_argument(arg + " is not a valid port number!");
+                        options.servePort = port;
+                    }
+                    else throw std::invalid_argument("Missing argument [PORT] to flag " + ARG_SERVE);
+                }
+                else if (arg == ARG_UPSTREAM) {
+                    if (i+1 < argc) {
+                        arg = argv[++i];
+                        std::string ip = arg.substr(0, arg.find(':'));
+                        int port{53};
+                        if (ip.length() < arg.length()) {
+                            try {
+                                port = std::stoi(arg.substr(ip.length() + 1));
+                            }
+                            catch (std::logic_error &e) {
+                                throw std::invalid_argument(arg + " does not contain a valid port number!");
+                            }
+                        }
+                        if (!std::regex_match(ip, Config::ipRegex))
+                            throw std::invalid_argument(ip + " is not a valid IP address!");
+                        else if (port <= 0 || port > 65535)
+                            throw std::invalid_argument(arg + " does not contain a valid port number!");
+                        options.upstreamDNS = ip;
+                        options.upstreamPort = port;
+                    }
+                    else throw std::invalid_argument("Missing argument [IP_ADDRESS[:PORT]] to flag " + ARG_UPSTREAM);
+                }
+                else if (arg == ARG_REFRESH_INTERVAL) {
+                    if (i+1 < argc) {
+                        arg = argv[++i];
+                        int seconds;
+                        try {
+                            seconds = std::stoi(arg);
+                        }
+                        catch (std::logic_error &e) {
+                            throw std::invalid_argument("Could not convert \"" + arg + "\" to a number of seconds");
+                        }
+                        if (seconds < 0)
+                            throw std::invalid_argument(arg + " is not a valid refresh interval!");
+                        options.refreshInterval = seconds;
+                    }
+                    else throw std::invalid_argument("Missing argument [SECONDS] to flag " + ARG_REFRESH_INTERVAL);
+                }
                 else if (arg == ARG_HELP) {
                     printHelp(argv[0]);
                 }
             }
         }
 
-        config.configure();
+        if (options.servePort >= 0 && options.upstreamDNS == "")
+            throw std::invalid_argument("Flag " + ARG_SERVE + " requires an upstream DNS server, set with " + ARG_UPSTREAM);
+        if (options.rollbackGeneration > 0 && options.outFile == "")
+            throw std::invalid_argument("Flag " + ARG_ROLLBACK + " requires an output file, set with " + ARG_OUT_FILE);
+
         return true;
     }
     catch (SQLite::except::Readonly &e) {
@@ -219,120 +407,211 @@ bool configure(Config &config, int argc, char *argv[]) {
     }
 }
 
-int main(int argc, char *argv[])
-{
-    SQLite::DB configDB(dbFileName);
-    Config config(":memory:");
-    SQLite::DB::copy(configDB, config.m_db);
+static bool writeHostsFile(Pipeline &pipeline, const std::string &file) {
+    try {
+        pipeline.writeHostsFile(file);
+    }
+    catch (const std::invalid_argument &e) {
+        std::cout << "Could not open the file " << e.what() << " for writing.\n"
+                     "Please make sure that the parent directories exist and the file itself is writable" << std::endl;
+        return false;
+    }
+    catch (const SQLite::except::SQLiteError &e) {
+        std::cerr << "Could not read or update the configuration database.\n"
+                  << "Error: " << e.what() << std::endl;
+        return false;
+    }
+    return true;
+}
 
+static bool refresh(Pipeline &pipeline) {
     try {
-        if (!configure(config, argc, argv)) return EXIT_FAILURE;
+        return pipeline.refresh();
     }
-    catch(std::invalid_argument &e) {
-        std::cout << e.what() << std::endl;
-        std::exit(EXIT_FAILURE);
+    catch (SQLite::except::Readonly &e) {
+        std::cerr << "Could not modify the configuration database.\n"
+                  << "Do you have the necessary permissions?\n"
+                  << "Error: " << e.what() << std::endl;
+    }
+    catch (SQLite::except::SQLiteError &e) {
+        // Most likely another process held the database for longer than the busy timeout
+        std::cerr << "Could not update the configuration database.\n"
+                  << "Error: " << e.what() << std::endl;
+        return false;
     }
+    return true;
+}
 
-    if (config.outFile() != "") {
-        CURLcode result = curl_global_init(CURL_GLOBAL_DEFAULT);
+static void printSources(Pipeline &pipeline) {
+    std::cout << std::left << std::setw(4) << "ID" << std::setw(10) << "STATUS" << std::setw(10) << "LATENCY"
+              << std::setw(12) << "THROUGHPUT" << std::setw(10) << "FAILURES" << std::setw(18) << "LAST SUCCESS"
+              << "URL\n";
 
-        if (result != 0){
-            std::cerr << "Failed to initialize libcurl" << std::endl;
-            return EXIT_FAILURE;
+    for (const SourceHealth &source : pipeline.sources()) {
+        std::string latency = source.latency > 0 ? std::to_string(source.latency) + " ms" : "-";
+        std::string throughput = source.throughput > 0 ? std::to_string(source.throughput / 1024) + " KiB/s" : "-";
+        std::string lastSuccess{"never"};
+        if (source.lastSuccess > 0) {
+            char buffer[32];
+            std::time_t time = static_cast<std::time_t>(source.lastSuccess);
+            std::strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M", std::localtime(&time));
+            lastSuccess = buffer;
         }
-        else {
-            CURL *curl = curl_easy_init();
-            // Abort if the download speed is below 100 b/s for 10 seconds
-            result = curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, 100);
-            result = curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, 10);
-            // Try to get the file's last updated time first
-            result = curl_easy_setopt(curl, CURLOPT_FILETIME, 1);
-            // Set a custom user agent to fool servers
-            // result = curl_easy_setopt(curl, CURLOPT_USERAGENT, "User Agent");
-            // Only allow protocol redirects on HTTP and HTTPS
-            result = curl_easy_setopt(curl, CURLOPT_REDIR_PROTOCOLS, CURLPROTO_HTTP | CURLPROTO_HTTPS);
-            // Only allow HTTP(S) protocols
-            result = curl_easy_setopt(curl, CURLOPT_PROTOCOLS, CURLPROTO_HTTP | CURLPROTO_HTTPS);
-            // Default schemeless urls to https
-            result = curl_easy_setopt(curl, CURLOPT_DEFAULT_PROTOCOL, "https");
-
-            std::vector<std::string> hosts = config.getHostUrls();
-            std::string fileName;
-            std::string hostName;
-            size_t start;
-            size_t end;
-            std::ifstream file;
-            for (const std::string &host : hosts) {
-                if (std::regex_match(host, Config::urlRegex)) {
-                    // Find beginning of substring
-                    start = host.find("https://");
-                    if (start == std::string::npos) {
-                        start = host.find("http://");
-                        if (start == std::string::npos) {
-                            start = 0;
-                        }
-                        else start = 7;
-                    }
-                    else start = 8;
-
-                    // Find end of domain substring
-                    end = host.find_first_of('/', start+1);
-                    if (end == std::string::npos) {
-                        // We want to get to the end if this is npos
-                        // Leave it as npos, since that gives the end
-                        end = host.find_first_of('?', start);
-                    }
 
-                    // Pull domain out
-                    hostName = host.substr(start, end-start);
-                    fileName = "/tmp/shadowhosts-" + hostName;
-                    std::FILE *cfile = std::fopen(fileName.c_str(), "w");
-                    if (std::ferror(cfile))
-                        std::perror("Failed to open file");
-                    curl_easy_setopt(curl, CURLOPT_WRITEDATA, cfile);
-
-                    // Set URL for request
-                    curl_easy_setopt(curl, CURLOPT_URL, host.c_str());
-                    result = curl_easy_perform(curl);
-                    std::fclose(cfile);
-
-                    if (result == CURLE_OK) {
-                        file.open(fileName);
-                        if (!file.fail()) {
-                            std::string line;
-                            while(std::getline(file, line)) {
-                                config.insertEntry(host, line);
-                            }
-                        }
-                        file.close();
-                    }
-                }
-            }
+        std::cout << std::setw(4) << source.id << std::setw(10) << (source.enabled ? "enabled" : "disabled")
+                  << std::setw(10) << latency << std::setw(12) << throughput << std::setw(10) << source.failureStreak
+                  << std::setw(18) << lastSuccess << source.url << '\n';
+    }
+    std::cout << std::flush;
+}
+
+static void printGenerations(Pipeline &pipeline) {
+    std::cout << std::left << std::setw(6) << "ID" << std::setw(18) << "CREATED" << "ENTRIES\n";
+    for (const Generation &generation : pipeline.generations()) {
+        char buffer[32];
+        std::time_t time = static_cast<std::time_t>(generation.created);
+        std::strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M", std::localtime(&time));
+        std::cout << std::setw(6) << generation.id << std::setw(18) << buffer << generation.entries << '\n';
+    }
+    std::cout << std::flush;
+}
+
+static bool printDiff(Pipeline &pipeline, int from, int to) {
+    try {
+        pipeline.diffGenerations(from, to, [](const EntryChange &change) -> void {
+            if (change.type == EntryChange::ADDED)
+                std::cout << "+ " << change.ip << ' ' << change.hostname << '\n';
+            else if (change.type == EntryChange::REMOVED)
+                std::cout << "- " << change.oldIP << ' ' << change.hostname << '\n';
+            else
+                std::cout << "~ " << change.hostname << ' ' << change.oldIP << " -> " << change.ip << '\n';
+        }, [](bool added, const std::string &line) -> void {
+            std::cout << (added ? "+ config " : "- config ") << line << '\n';
+        });
+    }
+    catch (const std::invalid_argument &e) {
+        std::cerr << e.what() << std::endl;
+        return false;
+    }
+    catch (const std::runtime_error &e) {
+        // Stored generation data that can't be decoded
+        std::cerr << e.what() << std::endl;
+        return false;
+    }
+    std::cout << std::flush;
+    return true;
+}
+
+static bool rollback(Pipeline &pipeline, int generation, const std::string &file) {
+    try {
+        pipeline.rollback(generation, file);
+    }
+    catch (const std::invalid_argument &e) {
+        std::cerr << "Could not write generation " << generation << ": " << e.what() << std::endl;
+        return false;
+    }
+    catch (const std::runtime_error &e) {
+        std::cerr << "Could not write generation " << generation << ": " << e.what() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+static void stopServing(int) { serving = false; }
+
+static int serve(Pipeline &pipeline, const RunOptions &options) {
+    DNSServer server(static_cast<uint16_t>(options.servePort), options.upstreamDNS,
+                     static_cast<uint16_t>(options.upstreamPort));
+    try {
+        server.bind();
+    }
+    catch (const std::runtime_error &e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // Start answering from the entries already in the database, then refresh in the background
+    server.update(pipeline.buildIndex());
+    std::cout << "Serving DNS on 127.0.0.1:" << server.port() << std::endl;
 
-            curl_easy_cleanup(curl);
+    serving = true;
+    std::signal(SIGINT, stopServing);
+    std::signal(SIGTERM, stopServing);
+
+    std::thread worker([&server]() -> void {
+        try {
+            server.run();
+        }
+        catch (const std::runtime_error &e) {
+            std::cerr << e.what() << std::endl;
+            serving = false;
         }
+    });
 
-        curl_global_cleanup();
+    bool refreshing{true};
+    auto nextRefresh = std::chrono::steady_clock::now();
+    while (serving) {
+        if (refreshing && std::chrono::steady_clock::now() >= nextRefresh) {
+            if (refresh(pipeline)) {
+                if (options.outFile != "") writeHostsFile(pipeline, options.outFile);
+                server.update(pipeline.buildIndex());
+            }
+            refreshing = options.refreshInterval > 0;
+            nextRefresh = std::chrono::steady_clock::now() + std::chrono::seconds(options.refreshInterval);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(250));
     }
 
+    server.stop();
+    worker.join();
+    return EXIT_SUCCESS;
+}
+
+
+int main(int argc, char *argv[])
+{
+    std::unique_ptr<Pipeline> pipeline;
+    RunOptions options;
+
     try {
-        SQLite::DB::copy(config.m_db, configDB);
+        pipeline.reset(new Pipeline(dbFileName));
+        bool configured = pipeline->configure([&](Config &config) -> bool {
+            return configure(config, options, argc, argv);
+        });
+        if (!configured) return EXIT_FAILURE;
     }
     catch (SQLite::except::Readonly &e) {
         std::cerr << "Could not modify the configuration database.\n"
                   << "Do you have the necessary permissions?\n"
                   << "Error: " << e.what() << std::endl;
     }
+    catch (SQLite::except::SQLiteError &e) {
+        std::cerr << "Could not open configuration database file.\n"
+                  << "Error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (!pipeline) return EXIT_FAILURE;
 
-    if (config.outFile() != "") {
-        try {
-            config.saveToFile();
-        }
-        catch (const std::invalid_argument &e) {
-            std::cout << "Could not open the file " << e.what() << " for writing.\n"
-                         "Please make sure that the parent directories exist and the file itself is writable" << std::endl;
-            return EXIT_FAILURE;
-        }
+    if (options.servePort >= 0) return serve(*pipeline, options);
+
+    // A rollback only rewrites the output, so it needs neither the network nor the entries
+    if (options.rollbackGeneration > 0) {
+        if (!rollback(*pipeline, options.rollbackGeneration, options.outFile)) return EXIT_FAILURE;
+    }
+    else if (options.outFile != "") {
+        if (!refresh(*pipeline)) return EXIT_FAILURE;
+    }
+
+    if (options.listSources) printSources(*pipeline);
+
+    if (options.outFile != "" && options.rollbackGeneration == 0) {
+        if (!writeHostsFile(*pipeline, options.outFile)) return EXIT_FAILURE;
+    }
+
+    if (options.listGenerations) printGenerations(*pipeline);
+
+    if (options.diffGenerations.first > 0) {
+        if (!printDiff(*pipeline, options.diffGenerations.first, options.diffGenerations.second)) return EXIT_FAILURE;
     }
 
     return EXIT_SUCCESS;
@@ -0,0 +1,596 @@
+#include <algorithm>
+#include <map>
+#include <stdexcept>
+#include "patternmatcher.h"
+#include "hostname.h"
+
+const size_t PatternMatcher::MAX_DFA_STATES{20000};
+
+static const int MAX_REPEAT{64};
+
+struct PatternMatcher::Node {
+    enum Kind { SET, EMPTY, CAT, ALT, STAR, PLUS, QUEST, REPEAT } kind;
+    CharSet set;
+    std::vector<Node> children;
+    int min{0};
+    int max{0}; // -1 for unbounded
+
+    explicit Node(Kind k): kind{k} {}
+};
+
+static char fold(char c) {
+    foldCase(&c, 1);
+    return c;
+}
+
+/*
+ * Recursive descent parser for the regular expression subset, producing
+ * a syntax tree. Errors are reported as std::invalid_argument.
+ */
+class PatternMatcher::Parser {
+public:
+    explicit Parser(const std::string &pattern): m_pattern(pattern) {}
+
+    Node parse() {
+        Node node = alternation();
+        if (m_pos < m_pattern.length())
+            fail("unexpected '" + std::string(1, m_pattern[m_pos]) + "'");
+        return node;
+    }
+
+private:
+    const std::string &m_pattern;
+    size_t m_pos{0};
+
+    [[noreturn]] void fail(const std::string &reason) const {
+        throw std::invalid_argument(m_pattern + " is not a valid pattern: " + reason);
+    }
+
+    bool atEnd() const { return m_pos >= m_pattern.length(); }
+    char peek() const { return m_pattern[m_pos]; }
+
+    static void addChar(CharSet &set, char c) {
+        set.set(static_cast<unsigned char>(c));
+        set.set(static_cast<unsigned char>(fold(c)));
+    }
+
+    static CharSet anyByte() {
+        CharSet set;
+        for (int c = 0; c < 256; ++c) set.set(c);
+        return set;
+    }
+
+    Node alternation() {
+        Node left = concatenation();
+        if (atEnd() || peek() != '|') return left;
+
+        Node alt(Node::ALT);
+        alt.children.push_back(std::move(left));
+        while (!atEnd() && peek() == '|') {
+            ++m_pos;
+            alt.children.push_back(concatenation());
+        }
+        return alt;
+    }
+
+    Node concatenation() {
+        Node cat(Node::CAT);
+        while (!atEnd() && peek() != '|' && peek() != ')')
+            cat.children.push_back(repetition());
+
+        if (cat.children.empty()) return Node(Node::EMPTY);
+        if (cat.children.size() == 1) return std::move(cat.children.front());
+        return cat;
+    }
+
+    int number() {
+        size_t start = m_pos;
+        int value{0};
+        while (!atEnd() && peek() >= '0' && peek() <= '9') {
+            value = value * 10 + (peek() - '0');
+            if (value > MAX_REPEAT) fail("repetition count above " + std::to_string(MAX_REPEAT));
+            ++m_pos;
+        }
+        if (start == m_pos) fail("expected a number in {}");
+        return value;
+    }
+
+    Node repetition() {
+        Node atom = this->atom();
+        bool anchor = atom.kind == Node::SET && (atom.set.test(BEGIN) || atom.set.test(END));
+        while (!atEnd()) {
+            char c = peek();
+            if (anchor && (c == '*' || c == '+' || c == '?' || c == '{'))
+                fail("nothing to repeat before '" + std::string(1, c) + "'");
+            Node::Kind kind;
+            int min{0}, max{0};
+            if (c == '*') kind = Node::STAR;
+            else if (c == '+') kind = Node::PLUS;
+            else if (c == '?') kind = Node::QUEST;
+            else if (c == '{') {
+                kind = Node::REPEAT;
+                ++m_pos;
+                min = max = number();
+                if (!atEnd() && peek() == ',') {
+                    ++m_pos;
+                    max = (!atEnd() && peek() == '}') ? -1 : number();
+                }
+                if (atEnd() || peek() != '}') fail("missing '}'");
+                if (max != -1 && max < min) fail("bad repetition range");
+            }
+            else break;
+            ++m_pos;
+
+            Node repeat(kind);
+            repeat.min = min;
+            repeat.max = max;
+            repeat.children.push_back(std::move(atom));
+            atom = std::move(repeat);
+        }
+        return atom;
+    }
+
+    CharSet escape() {
+        if (atEnd()) fail("trailing '\\'");
+        char c = m_pattern[m_pos++];
+        CharSet set;
+        switch (c) {
+            case 'd': case 'D':
+                for (char d = '0'; d <= '9'; ++d) set.set(static_cast<unsigned char>(d));
+                break;
+            case 'w': case 'W':
+                for (char d = '0'; d <= '9'; ++d) set.set(static_cast<unsigned char>(d));
+                for (char d = 'a'; d <= 'z'; ++d) addChar(set, d);
+                set.set('_');
+                break;
+            case 's': case 'S':
+                for (char d : std::string(" \t\r\n\f\v")) set.set(static_cast<unsigned char>(d));
+                break;
+            default:
+                if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9'))
+                    fail("unsupported escape '\\" + std::string(1, c) + "'");
+                addChar(set, c);
+                return set;
+        }
+        if (c == 'D' || c == 'W' || c == 'S') {
+            set.flip();
+            set.reset(BEGIN);
+            set.reset(END);
+        }
+        return set;
+    }
+
+    CharSet characterClass() {
+        CharSet set;
+        bool negate{false};
+        if (!atEnd() && peek() == '^') {
+            negate = true;
+            ++m_pos;
+        }
+
+        bool first{true};
+        while (!atEnd() && (peek() != ']' || first)) {
+            first = false;
+            char c = m_pattern[m_pos++];
+            if (c == '\\') {
+                set |= escape();
+                continue;
+            }
+            if (m_pos + 1 < m_pattern.length() && peek() == '-' && m_pattern[m_pos + 1] != ']') {
+                char last = m_pattern[m_pos + 1];
+                if (last == '\\') fail("escapes can't end a range");
+                if (last < c) fail("bad range in []");
+                for (int d = static_cast<unsigned char>(c); d <= static_cast<unsigned char>(last); ++d)
+                    addChar(set, static_cast<char>(d));
+                m_pos += 2;
+            }
+            else addChar(set, c);
+        }
+        if (atEnd()) fail("missing ']'");
+        ++m_pos;
+
+        if (negate) {
+            set.flip();
+            set.reset(BEGIN);
+            set.reset(END);
+        }
+        return set;
+    }
+
+    Node atom() {
+        char c = m_pattern[m_pos++];
+        Node node(Node::SET);
+        switch (c) {
+            case '(': {
+                if (m_pattern.compare(m_pos, 2, "?:") == 0) m_pos += 2;
+                else if (!atEnd() && peek() == '?') fail("only (?:) groups are supported");
+                Node inner = alternation();
+                if (atEnd() || peek() != ')') fail("missing ')'");
+                ++m_pos;
+                return inner;
+            }
+            case '[':
+                node.set = characterClass();
+                break;
+            case '.':
+                node.set = anyByte();
+                break;
+            case '^':
+                node.set.set(BEGIN);
+                break;
+            case '$':
+                node.set.set(END);
+                break;
+            case '\\':
+                node.set = escape();
+                break;
+            case '*': case '+': case '?': case '{': case ')':
+                fail("nothing to repeat before '" + std::string(1, c) + "'");
+            default:
+                addChar(node.set, c);
+        }
+        return node;
+    }
+};
+
+PatternMatcher::Node PatternMatcher::parse(const std::string &pattern) {
+    if (pattern.empty()) throw std::invalid_argument("Empty patterns are not allowed");
+
+    if (pattern[0] == '^') return Parser(pattern).parse();
+
+    // Globs always cover the whole domain. A leading '*' is left out along
+    // with the start anchor: patterns are already tried at every position,
+    // so "*.example.com" becomes a plain suffix match and the automaton for
+    // such rules stays as small as an Aho-Corasick trie
+    Node cat(Node::CAT);
+    size_t start = pattern.find_first_not_of('*');
+    if (start == std::string::npos) start = pattern.length();
+    if (start == 0) {
+        Node begin(Node::SET);
+        begin.set.set(BEGIN);
+        cat.children.push_back(begin);
+    }
+
+    for (char c : pattern.substr(start)) {
+        Node node(Node::SET);
+        if (c == '*' || c == '?') {
+            for (int b = 0; b < 256; ++b) node.set.set(b);
+            if (c == '*') {
+                Node star(Node::STAR);
+                star.children.push_back(std::move(node));
+                cat.children.push_back(std::move(star));
+                continue;
+            }
+        }
+        else node.set.set(static_cast<unsigned char>(fold(c)));
+        cat.children.push_back(std::move(node));
+    }
+
+    Node end(Node::SET);
+    end.set.set(END);
+    cat.children.push_back(end);
+    return cat;
+}
+
+void PatternMatcher::validate(const std::string &pattern) { parse(pattern); }
+
+void PatternMatcher::normalize(std::string &pattern) {
+    if (pattern.empty() || pattern[0] == '^') {
+        // Rewriting a regular expression could change its meaning, e.g. \D to \d
+        for (char c : pattern) {
+            if (static_cast<unsigned char>(c) >= 0x80)
+                throw std::invalid_argument(pattern + " is not a valid pattern: "
+                                            "write international labels in their xn-- form");
+        }
+        return;
+    }
+
+    bool ascii = !foldCase(&pattern[0], pattern.length());
+    size_t length = pattern.find_last_not_of('.');
+    pattern.resize(length == std::string::npos ? 0 : length + 1);
+    if (ascii) return;
+
+    // Only whole labels can be encoded, so a wildcard can't share a label with non-ASCII
+    size_t start{0};
+    while (start <= pattern.length()) {
+        size_t end = std::min(pattern.find('.', start), pattern.length());
+        std::string label = pattern.substr(start, end - start);
+        bool wildcard = label.find_first_of("*?") != std::string::npos;
+        bool international = std::any_of(label.begin(), label.end(), [](char c) -> bool {
+            return static_cast<unsigned char>(c) >= 0x80;
+        });
+        if (wildcard && international)
+            throw std::invalid_argument(pattern + " is not a valid pattern: "
+                                        "wildcards can't be combined with non-ASCII characters in one label");
+        start = end + 1;
+    }
+
+    if (!encodeIDN(pattern))
+        throw std::invalid_argument(pattern + " is not a valid pattern: a label can't be encoded as IDNA");
+}
+
+int PatternMatcher::newState(NFAState::Type type) {
+    NFAState state;
+    state.type = type;
+    m_nfa.push_back(state);
+    return static_cast<int>(m_nfa.size() - 1);
+}
+
+void PatternMatcher::patch(const Fragment &fragment, int target) {
+    for (const auto &hole : fragment.dangling) {
+        if (hole.second == 0) m_nfa[hole.first].out = target;
+        else m_nfa[hole.first].out1 = target;
+    }
+}
+
+// Thompson construction; SPLIT states with out1 == -1 are plain epsilon moves
+PatternMatcher::Fragment PatternMatcher::build(const Node &node) {
+    Fragment fragment;
+    switch (node.kind) {
+        case Node::SET: {
+            int state = newState(NFAState::SET);
+            m_nfa[state].set = node.set;
+            fragment.start = state;
+            fragment.dangling.emplace_back(state, 0);
+            break;
+        }
+        case Node::EMPTY: {
+            int state = newState(NFAState::SPLIT);
+            fragment.start = state;
+            fragment.dangling.emplace_back(state, 0);
+            break;
+        }
+        case Node::CAT: {
+            fragment = build(node.children.front());
+            for (size_t i = 1; i < node.children.size(); ++i) {
+                Fragment next = build(node.children[i]);
+                patch(fragment, next.start);
+                fragment.dangling = std::move(next.dangling);
+            }
+            break;
+        }
+        case Node::ALT: {
+            fragment = build(node.children.front());
+            for (size_t i = 1; i < node.children.size(); ++i) {
+                Fragment next = build(node.children[i]);
+                int split = newState(NFAState::SPLIT);
+                m_nfa[split].out = fragment.start;
+                m_nfa[split].out1 = next.start;
+                fragment.start = split;
+                fragment.dangling.insert(fragment.dangling.end(), next.dangling.begin(), next.dangling.end());
+            }
+            break;
+        }
+        case Node::STAR:
+        case Node::QUEST: {
+            Fragment inner = build(node.children.front());
+            int split = newState(NFAState::SPLIT);
+            m_nfa[split].out = inner.start;
+            if (node.kind == Node::STAR) {
+                patch(inner, split);
+            }
+            else {
+                fragment.dangling = std::move(inner.dangling);
+            }
+            fragment.start = split;
+            fragment.dangling.emplace_back(split, 1);
+            break;
+        }
+        case Node::PLUS: {
+            Fragment inner = build(node.children.front());
+            int split = newState(NFAState::SPLIT);
+            m_nfa[split].out = inner.start;
+            patch(inner, split);
+            fragment.start = inner.start;
+            fragment.dangling.emplace_back(split, 1);
+            break;
+        }
+        case Node::REPEAT: {
+            // Expand x{n,m} into n copies of x followed by (m - n) optional copies
+            Node expanded(Node::CAT);
+            for (int i = 0; i < node.min; ++i)
+                expanded.children.push_back(node.children.front());
+            if (node.max == -1) {
+                Node star(Node::STAR);
+                star.children.push_back(node.children.front());
+                expanded.children.push_back(std::move(star));
+            }
+            else {
+                for (int i = node.min; i < node.max; ++i) {
+                    Node quest(Node::QUEST);
+                    quest.children.push_back(node.children.front());
+                    expanded.children.push_back(std::move(quest));
+                }
+            }
+            if (expanded.children.empty()) expanded = Node(Node::EMPTY);
+            fragment = build(expanded);
+            break;
+        }
+    }
+    return fragment;
+}
+
+PatternMatcher::PatternMatcher(size_t maxDFAStates): m_maxDFAStates{std::max<size_t>(1, maxDFAStates)} {}
+
+void PatternMatcher::add(const std::string &pattern) {
+    Fragment fragment = build(parse(pattern));
+    patch(fragment, newState(NFAState::MATCH));
+    m_starts.push_back(fragment.start);
+}
+
+bool PatternMatcher::empty() const { return m_starts.empty(); }
+
+size_t PatternMatcher::dfaStates() const { return m_dfaSets.size(); }
+
+void PatternMatcher::addClosure(std::vector<int> &states, Scratch &scratch, int state) const {
+    // The start closure is part of every set, so it is never stored explicitly
+    if (state < 0 || m_inStart[state] || scratch.marks[state] == scratch.generation) return;
+    scratch.marks[state] = scratch.generation;
+
+    const NFAState &nfa = m_nfa[state];
+    if (nfa.type == NFAState::SPLIT) {
+        addClosure(states, scratch, nfa.out);
+        addClosure(states, scratch, nfa.out1);
+    }
+    else states.push_back(state);
+}
+
+std::vector<int> PatternMatcher::step(const std::vector<int> &states, int symbol, Scratch &scratch) const {
+    std::vector<int> next;
+    if (scratch.marks.size() != m_nfa.size()) scratch.marks.assign(m_nfa.size(), 0);
+    ++scratch.generation;
+
+    // Every pattern may start at any position; anchors are symbols of their own
+    for (int state : m_startMoves[m_classOf[symbol]]) {
+        scratch.marks[state] = scratch.generation;
+        next.push_back(state);
+    }
+    for (int state : states) {
+        const NFAState &nfa = m_nfa[state];
+        if (nfa.type == NFAState::SET && nfa.set.test(symbol))
+            addClosure(next, scratch, nfa.out);
+    }
+
+    std::sort(next.begin(), next.end());
+    return next;
+}
+
+bool PatternMatcher::accepting(const std::vector<int> &states) const {
+    if (m_startAccepting) return true;
+    for (int state : states) {
+        if (m_nfa[state].type == NFAState::MATCH) return true;
+    }
+    return false;
+}
+
+void PatternMatcher::compile() {
+    m_transitions.clear();
+    m_accepting.clear();
+    m_dfaSets.clear();
+    m_dfaStart = -1;
+    if (m_starts.empty()) return;
+
+    // Split the symbols into classes that every SET state treats alike
+    std::vector<int> classOf(SYMBOLS, 0);
+    int classes{1};
+    for (const NFAState &state : m_nfa) {
+        if (state.type != NFAState::SET) continue;
+        std::map<std::pair<int, bool>, int> refined;
+        for (int symbol = 0; symbol < SYMBOLS; ++symbol) {
+            auto key = std::make_pair(classOf[symbol], static_cast<bool>(state.set.test(symbol)));
+            auto found = refined.find(key);
+            if (found == refined.end())
+                found = refined.emplace(key, static_cast<int>(refined.size())).first;
+            classOf[symbol] = found->second;
+        }
+        classes = static_cast<int>(refined.size());
+    }
+
+    m_classes = classes;
+    std::vector<int> representative(classes, 0);
+    for (int symbol = SYMBOLS - 1; symbol >= 0; --symbol) {
+        m_classOf[symbol] = static_cast<uint16_t>(classOf[symbol]);
+        representative[classOf[symbol]] = symbol;
+    }
+
+    // Closure of the pattern starts, and where it leads on each class
+    std::vector<int> startSet;
+    std::vector<int> pending(m_starts.begin(), m_starts.end());
+    m_inStart.assign(m_nfa.size(), 0);
+    m_startAccepting = false;
+    while (!pending.empty()) {
+        int state = pending.back();
+        pending.pop_back();
+        if (state < 0 || m_inStart[state]) continue;
+        m_inStart[state] = 1;
+
+        const NFAState &nfa = m_nfa[state];
+        if (nfa.type == NFAState::SPLIT) {
+            pending.push_back(nfa.out);
+            pending.push_back(nfa.out1);
+        }
+        else {
+            startSet.push_back(state);
+            if (nfa.type == NFAState::MATCH) m_startAccepting = true;
+        }
+    }
+
+    Scratch scratch;
+    scratch.marks.assign(m_nfa.size(), 0);
+    m_startMoves.assign(m_classes, std::vector<int>());
+    for (int cls = 0; cls < m_classes; ++cls) {
+        ++scratch.generation;
+        for (int state : startSet) {
+            const NFAState &nfa = m_nfa[state];
+            if (nfa.type == NFAState::SET && nfa.set.test(representative[cls]))
+                addClosure(m_startMoves[cls], scratch, nfa.out);
+        }
+    }
+
+    // Subset construction, breadth first so that the states nearest the
+    // start are the ones built if m_maxDFAStates is reached
+    std::map<std::vector<int>, int> known;
+    std::vector<int> initial;
+
+    known.emplace(initial, 0);
+    m_dfaSets.push_back(initial);
+    m_accepting.push_back(accepting(initial));
+    m_dfaStart = 0;
+
+    for (size_t current = 0; current < m_dfaSets.size(); ++current) {
+        m_transitions.resize((current + 1) * m_classes, -1);
+        // Matching stops at the first accepting state, so it needs no transitions
+        if (m_accepting[current]) continue;
+
+        for (int cls = 0; cls < m_classes; ++cls) {
+            std::vector<int> next = step(m_dfaSets[current], representative[cls], scratch);
+            auto found = known.find(next);
+            if (found == known.end()) {
+                if (m_dfaSets.size() >= m_maxDFAStates) continue;
+                found = known.emplace(next, static_cast<int>(m_dfaSets.size())).first;
+                m_accepting.push_back(accepting(next));
+                m_dfaSets.push_back(std::move(next));
+            }
+            m_transitions[current * m_classes + cls] = found->second;
+        }
+    }
+}
+
+bool PatternMatcher::nfaMatches(std::vector<int> states, const char *domain, size_t length, size_t pos) const {
+    Scratch scratch;
+    for (; pos <= length; ++pos) {
+        int symbol = pos < length ? static_cast<unsigned char>(domain[pos]) : END;
+        states = step(states, symbol, scratch);
+        if (accepting(states)) return true;
+    }
+    return false;
+}
+
+bool PatternMatcher::matches(const char *domain, size_t length) const {
+    if (m_dfaStart < 0) return false;
+
+    // Feed BEGIN, the domain and then END
+    int state = m_dfaStart;
+    for (size_t i = 0; i <= length + 1; ++i) {
+        if (m_accepting[state]) return true;
+
+        int symbol;
+        if (i == 0) symbol = BEGIN;
+        else if (i <= length) symbol = static_cast<unsigned char>(domain[i - 1]);
+        else symbol = END;
+
+        int next = m_transitions[state * m_classes + m_classOf[symbol]];
+        if (next < 0) {
+            Scratch scratch;
+            std::vector<int> states = step(m_dfaSets[state], symbol, scratch);
+            if (accepting(states)) return true;
+            return i <= length && nfaMatches(std::move(states), domain, length, i);
+        }
+        state = next;
+    }
+    return m_accepting[state];
+}
+
+bool PatternMatcher::matches(const std::string &domain) const {
+    return matches(domain.data(), domain.length());
+}
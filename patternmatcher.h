@@ -0,0 +1,111 @@
+#ifndef PATTERNMATCHER_H
+#define PATTERNMATCHER_H
+
+#include <bitset>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*
+ * Matches a domain against any number of blacklist patterns in one pass.
+ *
+ * Patterns starting with '^' are regular expressions (a subset of ECMAScript:
+ * literals, '.', classes, groups, '|', '*', '+', '?', '{n,m}' and '$') that
+ * match a prefix of the domain, or all of it when they end in '$'. Any other
+ * pattern is a glob matched against the whole domain, where '*' matches any
+ * run of characters and '?' matches exactly one. Patterns match case-insensitively
+ * against domains that have been through normalizeHostname().
+ *
+ * All patterns are combined into a single NFA which compile() turns into a
+ * DFA. Once compiled the matcher is read-only and safe to share between threads.
+ */
+class PatternMatcher
+{
+public:
+    static const size_t MAX_DFA_STATES;
+
+    // maxDFAStates caps the memory compile() spends on the DFA
+    explicit PatternMatcher(size_t maxDFAStates = MAX_DFA_STATES);
+
+    void add(const std::string &pattern);
+    void compile();
+    bool empty() const;
+    // DFA states built by compile(); once it reaches the cap, part of the matching is done on the NFA
+    size_t dfaStates() const;
+
+    bool matches(const char *domain, size_t length) const;
+    bool matches(const std::string &domain) const;
+
+    // Throws std::invalid_argument if the pattern can't be parsed
+    static void validate(const std::string &pattern);
+    // Bring a glob into the form of the domains it matches, see normalizeHostname():
+    // fold case, strip trailing dots and IDNA-encode labels without wildcards.
+    // Regular expressions are left as they are. Throws std::invalid_argument if
+    // the pattern has non-ASCII characters that can't be encoded
+    static void normalize(std::string &pattern);
+
+private:
+    // Input symbols: every byte, plus markers for the start and end of the domain
+    static const int SYMBOLS{258};
+    static const int BEGIN{256};
+    static const int END{257};
+
+    typedef std::bitset<SYMBOLS> CharSet;
+
+    struct NFAState {
+        enum Type { SET, SPLIT, MATCH } type;
+        CharSet set;
+        int out{-1};
+        int out1{-1};
+    };
+
+    struct Node;
+    struct Fragment {
+        int start;
+        // (state, 0 for out or 1 for out1) still waiting for a target
+        std::vector<std::pair<int, int>> dangling;
+    };
+
+    class Parser;
+
+    static Node parse(const std::string &pattern);
+    Fragment build(const Node &node);
+    int newState(NFAState::Type type);
+    void patch(const Fragment &fragment, int target);
+
+    // Visited marks for closure walks, reset by bumping the generation
+    struct Scratch {
+        std::vector<uint32_t> marks;
+        uint32_t generation{0};
+    };
+
+    void addClosure(std::vector<int> &states, Scratch &scratch, int state) const;
+    std::vector<int> step(const std::vector<int> &states, int symbol, Scratch &scratch) const;
+    bool accepting(const std::vector<int> &states) const;
+
+    bool nfaMatches(std::vector<int> states, const char *domain, size_t length, size_t pos) const;
+
+    size_t m_maxDFAStates;
+    std::vector<NFAState> m_nfa;
+    std::vector<int> m_starts;
+
+    // Every DFA state implicitly contains the closure of m_starts; these
+    // describe that closure so the sets themselves only hold what differs
+    std::vector<char> m_inStart;
+    std::vector<std::vector<int>> m_startMoves;
+    bool m_startAccepting{false};
+
+    // Symbols that no pattern tells apart share a class and a DFA column
+    int m_classes{0};
+    uint16_t m_classOf[SYMBOLS];
+
+    // Row-major transition table; -1 marks a transition not built because the
+    // DFA hit m_maxDFAStates, in which case matching falls back to the NFA
+    std::vector<int> m_transitions;
+    std::vector<char> m_accepting;
+    std::vector<std::vector<int>> m_dfaSets;
+    int m_dfaStart{-1};
+};
+
+#endif // PATTERNMATCHER_H
@@ -0,0 +1,132 @@
+#include <stdexcept>
+#include "hostsfile.h"
+#include "pipeline.h"
+
+Pipeline::Pipeline(const std::string &configFile): m_config{configFile} {
+    m_config.beginTransaction();
+    try {
+        m_config.prepare();
+    }
+    catch (...) {
+        m_config.rollbackTransaction();
+        throw;
+    }
+    m_config.commitTransaction();
+    m_config.configure();
+
+    // Keep resumable downloads next to the configuration database
+    size_t slash = configFile.rfind('/');
+    m_config.cacheDir((slash == std::string::npos ? std::string(".") : configFile.substr(0, slash)) + "/shadowhosts-cache");
+}
+
+void Pipeline::checkNotConfiguring(const char *operation) const {
+    if (m_configuring)
+        throw std::logic_error(std::string(operation) + "() can't be called from inside a configure() change");
+}
+
+bool Pipeline::configure(const std::function<bool(Config &config)> &change) {
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+    checkNotConfiguring("configure");
+
+    // All of the change is written, or none of it
+    m_config.beginTransaction();
+    m_configuring = true;
+    try {
+        bool keep = change(m_config);
+        m_configuring = false;
+        if (!keep) {
+            m_config.rollbackTransaction();
+            return false;
+        }
+    }
+    catch (...) {
+        m_configuring = false;
+        m_config.rollbackTransaction();
+        throw;
+    }
+    m_config.commitTransaction();
+
+    // Pick up any sources that were added, removed or toggled
+    m_config.configure();
+    return true;
+}
+
+bool Pipeline::refresh(RefreshStats *stats) {
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+    checkNotConfiguring("refresh");
+    return downloadSources(m_config, m_config.getHostUrls(), stats);
+}
+
+void Pipeline::entries(const EntryCallback &callback) {
+    HostsFile hosts;
+    {
+        std::lock_guard<std::recursive_mutex> lock(m_mutex);
+        m_config.merge(hosts);
+    }
+    hosts.forEach(callback);
+}
+
+void Pipeline::writeHostsFile(const std::string &file) {
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+    checkNotConfiguring("writeHostsFile");
+    HostsFile hosts;
+    m_config.merge(hosts);
+    hosts.saveToFile(file);
+    m_config.recordGeneration(hosts);
+}
+
+std::unique_ptr<DomainIndex> Pipeline::buildIndex() {
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+    std::unique_ptr<DomainIndex> index{new DomainIndex()};
+    HostsFile hosts;
+    m_config.merge(hosts);
+    hosts.forEach([&index](const std::string &ip, const std::string &hostname) -> void {
+        index->insert(hostname, ip);
+    });
+    index->build();
+
+    std::unique_ptr<PatternMatcher> patterns{new PatternMatcher()};
+    m_config.compilePatterns(*patterns);
+    if (!patterns->empty()) index->setPatterns(std::move(patterns), m_config.getRedirectIP());
+    return index;
+}
+
+std::vector<SourceHealth> Pipeline::sources() {
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+    return m_config.sourceHealth();
+}
+
+std::vector<Generation> Pipeline::generations() {
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+    return m_config.generations();
+}
+
+void Pipeline::rollback(int generation, const std::string &file) {
+    std::string data, config;
+    {
+        std::lock_guard<std::recursive_mutex> lock(m_mutex);
+        m_config.generation(generation, data, config);
+    }
+
+    // Decode it all once first, so corrupt data throws before the hosts file is truncated
+    GenerationReader check(data);
+    while (check.next()) {}
+
+    HostsFile::writeFile(file, [&data](const HostsFile::EntryCallback &write) -> void {
+        GenerationReader reader(data);
+        while (reader.next()) write(reader.ip(), reader.hostname());
+    });
+}
+
+void Pipeline::diffGenerations(int from, int to, const std::function<void(const EntryChange &change)> &entries,
+                               const std::function<void(bool added, const std::string &line)> &config) {
+    std::string fromData, fromConfig, toData, toConfig;
+    {
+        std::lock_guard<std::recursive_mutex> lock(m_mutex);
+        m_config.generation(from, fromData, fromConfig);
+        m_config.generation(to, toData, toConfig);
+    }
+
+    diffLines(fromConfig, toConfig, config);
+    diffEntries(fromData, toData, entries);
+}
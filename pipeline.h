@@ -0,0 +1,65 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "config.h"
+#include "domainindex.h"
+#include "refresh.h"
+
+/*
+ * Entry point for embedding ShadowHosts in another program.
+ *
+ * A Pipeline works directly on the configuration database in configFile.
+ * Every operation writes only what it changes, in as few transactions as
+ * possible, so nothing is copied between memory and disk. Downloads are
+ * kept in a private shadowhosts-cache directory beside configFile. All methods
+ * may be called from any thread; they are serialized internally, and a
+ * refresh holds the pipeline for as long as the downloads take. Callbacks run
+ * on the calling thread and may call back into the pipeline, except that a
+ * configure() change can't start another configure(), refresh() or
+ * writeHostsFile(), since those need transactions of their own.
+ */
+class Pipeline
+{
+public:
+    typedef std::function<void(const std::string &ip, const std::string &hostname)> EntryCallback;
+
+    explicit Pipeline(const std::string &configFile);
+
+    // Apply change to the configuration; it is kept only if change returns true.
+    // Throws std::logic_error if called from inside another change
+    bool configure(const std::function<bool(Config &config)> &change);
+
+    // Download every enabled source, see downloadSources()
+    bool refresh(RefreshStats *stats = nullptr);
+
+    // Stream the merged entries, sorted by hostname. The pipeline isn't held
+    // while callback runs
+    void entries(const EntryCallback &callback);
+    // Also records the entries as a new generation, see Config::recordGeneration()
+    void writeHostsFile(const std::string &file);
+    std::unique_ptr<DomainIndex> buildIndex();
+    std::vector<SourceHealth> sources();
+
+    std::vector<Generation> generations();
+    // Write file from a stored generation, without downloading or merging anything.
+    // Throws std::invalid_argument if there is no such generation, std::runtime_error if it is corrupt
+    void rollback(int generation, const std::string &file);
+    // Throws like rollback()
+    void diffGenerations(int from, int to, const std::function<void(const EntryChange &change)> &entries,
+                         const std::function<void(bool added, const std::string &line)> &config);
+
+private:
+    void checkNotConfiguring(const char *operation) const;
+
+    // Recursive so that a configure() change can read through the pipeline
+    std::recursive_mutex m_mutex;
+    Config m_config;
+    bool m_configuring{false};
+};
+
+#endif // PIPELINE_H
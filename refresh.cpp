@@ -0,0 +1,555 @@
+#include <iostream>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <ctime>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <curl/curl.h>
+#include <openssl/evp.h>
+#include "refresh.h"
+#include "hostname.h"
+
+static double secondsSince(const std::chrono::steady_clock::time_point &start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// State of one transfer, shared between the libcurl callbacks
+struct Transfer {
+    std::FILE *file{nullptr};
+    std::string path;
+    long offset{0};     // Bytes already on disk when the request was made
+    long status{0};
+    bool started{false};
+    bool misaligned{false}; // A 206 that doesn't continue where the partial file ends
+    std::map<std::string, std::string> headers;
+};
+
+static std::string lower(std::string text) {
+    foldCase(&text[0], text.length());
+    return text;
+}
+
+static size_t onHeader(char *data, size_t size, size_t count, void *userdata) {
+    Transfer *transfer = static_cast<Transfer*>(userdata);
+    std::string line(data, size * count);
+    size_t end = line.find_last_not_of("\r\n");
+    line = end == std::string::npos ? "" : line.substr(0, end + 1);
+
+    if (line.compare(0, 5, "HTTP/") == 0) {
+        // Each response, including interim ones, starts over
+        transfer->headers.clear();
+        size_t code = line.find(' ');
+        transfer->status = code == std::string::npos ? 0 : std::strtol(line.c_str() + code + 1, nullptr, 10);
+    }
+    else {
+        size_t colon = line.find(':');
+        if (colon != std::string::npos) {
+            size_t value = line.find_first_not_of(" \t", colon + 1);
+            transfer->headers[lower(line.substr(0, colon))] = value == std::string::npos ? "" : line.substr(value);
+        }
+    }
+    return size * count;
+}
+
+static size_t onData(char *data, size_t size, size_t count, void *userdata) {
+    Transfer *transfer = static_cast<Transfer*>(userdata);
+
+    // Never let an error page overwrite or extend a partial download
+    if (transfer->status >= 400) return size * count;
+
+    if (!transfer->started) {
+        transfer->started = true;
+        if (transfer->status == 206) {
+            // Only append if the server continues exactly where we stopped
+            std::string range = transfer->headers["content-range"];
+            size_t first = range.find_first_of("0123456789");
+            if (first == std::string::npos || std::strtol(range.c_str() + first, nullptr, 10) != transfer->offset) {
+                transfer->misaligned = true;
+                return 0;
+            }
+        }
+        else if (transfer->offset > 0) {
+            // The server sent the whole list, either because it changed or it ignores ranges
+            std::fflush(transfer->file);
+            if (ftruncate(fileno(transfer->file), 0) != 0) return 0;
+            std::rewind(transfer->file);
+            transfer->offset = 0;
+        }
+    }
+
+    return std::fwrite(data, size, count, transfer->file) * size;
+}
+
+// Extracts the base64 SHA-256 from a Digest (RFC 3230) or Repr-Digest (RFC 9530) header
+static std::string advertisedSHA256(const std::map<std::string, std::string> &headers) {
+    for (const char *name : {"repr-digest", "digest"}) {
+        auto header = headers.find(name);
+        if (header == headers.end()) continue;
+
+        size_t pos = lower(header->second).find("sha-256=");
+        if (pos == std::string::npos) continue;
+
+        std::string value = header->second.substr(pos + 8);
+        value = value.substr(0, value.find(','));
+        value.erase(std::remove_if(value.begin(), value.end(), [](char c) -> bool {
+            return c == ':' || c == ' ' || c == '\t';
+        }), value.end());
+        return value;
+    }
+    return "";
+}
+
+static std::string fileSHA256(const std::string &path) {
+    std::ifstream file(path, std::ios::binary);
+    if (file.fail()) return "";
+
+    EVP_MD_CTX *context = EVP_MD_CTX_new();
+    EVP_DigestInit_ex(context, EVP_sha256(), nullptr);
+
+    char buffer[65536];
+    while (file.read(buffer, sizeof(buffer)) || file.gcount() > 0)
+        EVP_DigestUpdate(context, buffer, static_cast<size_t>(file.gcount()));
+
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int length{0};
+    EVP_DigestFinal_ex(context, digest, &length);
+    EVP_MD_CTX_free(context);
+
+    unsigned char encoded[4 * ((EVP_MAX_MD_SIZE + 2) / 3) + 1];
+    int encodedLength = EVP_EncodeBlock(encoded, digest, static_cast<int>(length));
+    return std::string(reinterpret_cast<char*>(encoded), static_cast<size_t>(encodedLength));
+}
+
+static long fileSize(const std::string &path) {
+    struct stat info;
+    return lstat(path.c_str(), &info) == 0 ? static_cast<long>(info.st_size) : -1;
+}
+
+// Never follows a symbolic link, so a planted link can't redirect the write
+static std::FILE* openPrivate(const std::string &path, bool append) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_NOFOLLOW | O_CLOEXEC | (append ? O_APPEND : O_TRUNC), 0600);
+    if (fd < 0) return nullptr;
+
+    std::FILE *file = fdopen(fd, append ? "ab" : "wb");
+    if (file == nullptr) close(fd);
+    return file;
+}
+
+// Exclusive flock() on a lock file, so processes sharing the cache directory
+// take turns with a source's files instead of writing and renaming them at once
+class CacheLock {
+public:
+    explicit CacheLock(const std::string &path) {
+        m_fd = open(path.c_str(), O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600);
+        while (m_fd >= 0 && flock(m_fd, LOCK_EX) != 0) {
+            if (errno == EINTR) continue;
+            close(m_fd);
+            m_fd = -1;
+        }
+    }
+    ~CacheLock() { if (m_fd >= 0) close(m_fd); }
+    CacheLock(const CacheLock&) = delete;
+    CacheLock& operator=(const CacheLock&) = delete;
+
+    bool held() const { return m_fd >= 0; }
+
+private:
+    int m_fd{-1};
+};
+
+/*
+ * Partial downloads are kept between runs and parsed into the hosts file,
+ * so they must live where no other user can plant or replace them: in
+ * config's cache directory, which has to be ours and closed to everyone
+ * else, or in a fresh temporary directory if config doesn't name one.
+ */
+static bool prepareCacheDir(Config &config) {
+    std::string dir = config.cacheDir();
+    if (dir.empty()) {
+        char temporary[] = "/tmp/shadowhosts-XXXXXX";
+        if (mkdtemp(temporary) == nullptr) {
+            std::perror("Failed to create a download directory");
+            return false;
+        }
+        config.cacheDir(temporary);
+        return true;
+    }
+
+    if (mkdir(dir.c_str(), 0700) != 0 && errno != EEXIST) {
+        std::cerr << dir << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+
+    struct stat info;
+    if (lstat(dir.c_str(), &info) != 0 || !S_ISDIR(info.st_mode) || info.st_uid != geteuid() ||
+            (info.st_mode & 077) != 0) {
+        std::cerr << dir << ": refusing to download into a directory that is not private to this user" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+enum FetchResult { FETCH_COMPLETE, FETCH_NOT_MODIFIED, FETCH_TOO_SLOW, FETCH_RETRY, FETCH_FAILED };
+
+/*
+ * Download host into fileName, resuming an earlier partial download when the
+ * server still has the same version. Partial data is kept in fileName.part
+ * and its ETag, full length and advertised digest in the config database.
+ * Once fileName holds a complete list, later requests carry its ETag in
+ * If-None-Match so an unchanged list isn't sent again.
+ * Returns FETCH_COMPLETE once fileName holds a complete list that passed the
+ * length and digest checks, FETCH_NOT_MODIFIED if the server confirmed the
+ * list already in fileName is current, FETCH_TOO_SLOW if the transfer fell below the
+ * low speed limit, and FETCH_RETRY if another attempt might succeed.
+ */
+static FetchResult fetch(CURL *curl, Config &config, const std::string &host, const std::string &fileName, RefreshStats *stats) {
+    DownloadState state = config.downloadState(host);
+
+    Transfer transfer;
+    transfer.path = fileName + ".part";
+
+    long existing = fileSize(transfer.path);
+    if (existing > 0 && !state.etag.empty() && existing < state.length) {
+        transfer.offset = existing;
+        transfer.file = openPrivate(transfer.path, true);
+    }
+    else transfer.file = openPrivate(transfer.path, false);
+
+    if (transfer.file == nullptr) {
+        std::perror("Failed to open file");
+        return FETCH_FAILED;
+    }
+
+    // The state describes the list in fileName unless a partial download is pending
+    bool conditional = transfer.offset == 0 && !state.etag.empty() && state.length > 0 &&
+                       fileSize(fileName) == state.length;
+
+    curl_slist *headers{nullptr};
+    std::string range;
+    if (transfer.offset > 0) {
+        // If-Range makes the server send the whole list again if it has changed since
+        range = std::to_string(transfer.offset) + "-";
+        headers = curl_slist_append(headers, ("If-Range: " + state.etag).c_str());
+    }
+    else if (conditional) headers = curl_slist_append(headers, ("If-None-Match: " + state.etag).c_str());
+
+    curl_easy_setopt(curl, CURLOPT_URL, host.c_str());
+    curl_easy_setopt(curl, CURLOPT_RANGE, range.empty() ? nullptr : range.c_str());
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, onHeader);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &transfer);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, onData);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &transfer);
+
+    CURLcode result = curl_easy_perform(curl);
+
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, nullptr);
+    curl_slist_free_all(headers);
+    if (transfer.file != nullptr) std::fclose(transfer.file);
+
+    // Our partial copy no longer lines up with what the server has
+    if (transfer.status == 416 || transfer.misaligned) {
+        if (transfer.misaligned)
+            std::cerr << host << ": server resumed at the wrong offset, starting over" << std::endl;
+        std::remove(transfer.path.c_str());
+        config.downloadState(host, DownloadState());
+        return FETCH_RETRY;
+    }
+
+    // A 304 carries no list; it only means something if we asked about the one we kept
+    if (transfer.status == 304) {
+        std::remove(transfer.path.c_str());
+        if (conditional) return FETCH_NOT_MODIFIED;
+        std::cerr << host << ": server answered HTTP 304 to an unconditional request" << std::endl;
+        return FETCH_FAILED;
+    }
+
+    // Nothing usable came back; leave any earlier partial download as it was
+    if (transfer.status == 0 || transfer.status >= 400) {
+        if (transfer.offset == 0) std::remove(transfer.path.c_str());
+        if (transfer.status == 0) {
+            std::cerr << host << ": " << curl_easy_strerror(result) << std::endl;
+            return FETCH_RETRY;
+        }
+        std::cerr << host << ": server answered HTTP " << transfer.status << std::endl;
+        // Client errors other than timeouts and rate limiting won't go away by asking again
+        bool transient = transfer.status >= 500 || transfer.status == 408 || transfer.status == 429;
+        return transient ? FETCH_RETRY : FETCH_FAILED;
+    }
+
+    long size = fileSize(transfer.path);
+    stats->bytes += static_cast<size_t>(std::max(0L, size - transfer.offset));
+
+    DownloadState next;
+    std::string etag = transfer.headers["etag"];
+    // Weak validators can't be used with If-Range
+    if (etag.compare(0, 2, "W/") != 0) next.etag = etag;
+    next.sha256 = advertisedSHA256(transfer.headers);
+
+    if (transfer.status == 206) {
+        std::string contentRange = transfer.headers["content-range"];
+        size_t slash = contentRange.find('/');
+        if (slash != std::string::npos) next.length = std::atoi(contentRange.c_str() + slash + 1);
+        if (next.sha256.empty()) next.sha256 = state.sha256;
+    }
+    else next.length = std::atoi(transfer.headers["content-length"].c_str());
+
+    if (result != CURLE_OK) {
+        bool resumable = !next.etag.empty() && next.length > 0 && size > 0 && size < next.length &&
+                         (transfer.status == 206 || lower(transfer.headers["accept-ranges"]) == "bytes");
+        std::cerr << host << ": " << curl_easy_strerror(result);
+        if (resumable) {
+            std::cerr << ", kept " << size << " of " << next.length << " bytes to resume from";
+            config.downloadState(host, next);
+        }
+        else {
+            std::remove(transfer.path.c_str());
+            config.downloadState(host, DownloadState());
+        }
+        std::cerr << std::endl;
+
+        // Without an overall timeout, timing out once the server has answered means too slow
+        return result == CURLE_OPERATION_TIMEDOUT && transfer.status != 0 ? FETCH_TOO_SLOW : FETCH_RETRY;
+    }
+
+    bool intact = next.length <= 0 || size == next.length;
+    if (intact && !next.sha256.empty()) intact = fileSHA256(transfer.path) == next.sha256;
+
+    if (!intact) {
+        std::cerr << host << ": downloaded list failed the length or SHA-256 check, discarding it" << std::endl;
+        std::remove(transfer.path.c_str());
+        config.downloadState(host, DownloadState());
+        return FETCH_RETRY;
+    }
+
+    config.downloadState(host, next);
+    if (std::rename(transfer.path.c_str(), fileName.c_str()) != 0) {
+        std::perror("Failed to move downloaded file");
+        return FETCH_FAILED;
+    }
+    return FETCH_COMPLETE;
+}
+
+static const long MIN_LOW_SPEED_LIMIT{100};
+
+// Connection limits and retries for one source, derived from its history
+struct SourcePolicy {
+    long connectTimeoutMs{30000};
+    long lowSpeedLimit{MIN_LOW_SPEED_LIMIT};
+    long lowSpeedTime{10};
+    int retries{2};
+    bool skip{false};
+    long long retryAt{0};
+};
+
+// Shorter transfers, like the tail of a resumed download, say little about a link's speed
+static const curl_off_t MIN_THROUGHPUT_SAMPLE{64 * 1024};
+static const int SKIP_AFTER_FAILURES{3};
+static const long long SKIP_BASE_SECONDS{15 * 60};
+static const long long SKIP_MAX_SECONDS{24 * 60 * 60};
+
+static SourcePolicy policyFor(const SourceHealth &health, long long now) {
+    SourcePolicy policy;
+
+    // Give up on connecting after a few round trips of what the source usually takes
+    if (health.latency > 0)
+        policy.connectTimeoutMs = std::min(30000L, std::max(2000L, 5L * health.latency));
+
+    // Abort a transfer once it runs twenty times slower than usual instead of
+    // waiting for the fixed 100 B/s floor; an interrupted transfer is resumed
+    if (health.throughput > 0)
+        policy.lowSpeedLimit = std::min(65536L, std::max(MIN_LOW_SPEED_LIMIT, health.throughput / 20L));
+    policy.lowSpeedTime = 10 + 5 * std::min(health.failureStreak, 4);
+
+    if (health.failureStreak >= SKIP_AFTER_FAILURES) {
+        // Back off exponentially from the last attempt, up to a day
+        long long backoff = SKIP_BASE_SECONDS << std::min(health.failureStreak - SKIP_AFTER_FAILURES, 10);
+        policy.retryAt = health.lastAttempt + std::min(backoff, SKIP_MAX_SECONDS);
+        policy.skip = now < policy.retryAt;
+        policy.retries = 0;
+    }
+    else if (health.failureStreak > 0) policy.retries = 1;
+
+    return policy;
+}
+
+bool downloadSources(Config &config, const std::vector<std::string> &urls, RefreshStats *stats) {
+    RefreshStats local;
+    if (stats == nullptr) stats = &local;
+
+    // curl_global_init() is not thread-safe, and cleaning up after each call
+    // would race with other threads still downloading, so initialize once per process
+    static std::once_flag curlInitialized;
+    static CURLcode initResult;
+    std::call_once(curlInitialized, []() -> void { initResult = curl_global_init(CURL_GLOBAL_DEFAULT); });
+    CURLcode result = initResult;
+
+    if (result != 0){
+        std::cerr << "Failed to initialize libcurl" << std::endl;
+        return false;
+    }
+    else if (!prepareCacheDir(config)) {
+        return false;
+    }
+    else {
+        // Owned by a unique_ptr so the handle is released when an exception, e.g.
+        // a SQLiteError from the cache bookkeeping, escapes the download loop
+        std::unique_ptr<CURL, decltype(&curl_easy_cleanup)> curl(curl_easy_init(), &curl_easy_cleanup);
+        if (!curl) {
+            std::cerr << "Failed to create a libcurl handle" << std::endl;
+            return false;
+        }
+        // Connect and low speed limits are set per source from its history, see policyFor()
+        // Try to get the file's last updated time first
+        result = curl_easy_setopt(curl.get(), CURLOPT_FILETIME, 1);
+        // Set a custom user agent to fool servers
+        // result = curl_easy_setopt(curl.get(), CURLOPT_USERAGENT, "User Agent");
+        // Only allow protocol redirects on HTTP and HTTPS
+        result = curl_easy_setopt(curl.get(), CURLOPT_REDIR_PROTOCOLS, CURLPROTO_HTTP | CURLPROTO_HTTPS);
+        // Only allow HTTP(S) protocols
+        result = curl_easy_setopt(curl.get(), CURLOPT_PROTOCOLS, CURLPROTO_HTTP | CURLPROTO_HTTPS);
+        // Default schemeless urls to https
+        result = curl_easy_setopt(curl.get(), CURLOPT_DEFAULT_PROTOCOL, "https");
+
+        // Sources that have been failing go last, the fastest ones first
+        std::vector<SourceHealth> sources;
+        for (const std::string &host : urls) sources.push_back(config.sourceHealth(host));
+        std::stable_sort(sources.begin(), sources.end(), [](const SourceHealth &a, const SourceHealth &b) -> bool {
+            if (a.failureStreak != b.failureStreak) return a.failureStreak < b.failureStreak;
+            return a.throughput > b.throughput;
+        });
+
+        long long now = static_cast<long long>(std::time(nullptr));
+        std::string fileName;
+        std::string hostName;
+        size_t start;
+        size_t end;
+        std::ifstream file;
+        for (const SourceHealth &health : sources) {
+            const std::string &host = health.url;
+            SourcePolicy policy = policyFor(health, now);
+            if (policy.skip) {
+                std::cerr << host << ": skipped after " << health.failureStreak << " failures in a row, next try in "
+                          << (policy.retryAt - now + 59) / 60 << " min" << std::endl;
+                ++stats->skipped;
+                continue;
+            }
+
+            // Find beginning of substring
+            start = host.find("https://");
+            if (start == std::string::npos) {
+                start = host.find("http://");
+                if (start == std::string::npos) {
+                    start = 0;
+                }
+                else start = 7;
+            }
+            else start = 8;
+
+            // Find end of domain substring
+            end = host.find_first_of('/', start+1);
+            if (end == std::string::npos) {
+                // We want to get to the end if this is npos
+                // Leave it as npos, since that gives the end
+                end = host.find_first_of('?', start);
+            }
+
+            // Pull domain out; the source id keeps lists from the same server apart
+            hostName = host.substr(start, end-start);
+            fileName = config.cacheDir() + "/" + hostName + "-" + std::to_string(config.sourceID(host));
+
+            // Held until the list is ingested; a process that waited here then
+            // usually finds the list current and gets a 304
+            CacheLock lock(fileName + ".lock");
+            if (!lock.held()) {
+                std::cerr << fileName << ".lock: " << std::strerror(errno) << std::endl;
+                ++stats->failures;
+                continue;
+            }
+
+            curl_easy_setopt(curl.get(), CURLOPT_CONNECTTIMEOUT_MS, policy.connectTimeoutMs);
+            curl_easy_setopt(curl.get(), CURLOPT_LOW_SPEED_LIMIT, policy.lowSpeedLimit);
+            curl_easy_setopt(curl.get(), CURLOPT_LOW_SPEED_TIME, policy.lowSpeedTime);
+
+            auto phaseStart = std::chrono::steady_clock::now();
+            FetchResult fetched = fetch(curl.get(), config, host, fileName, stats);
+            // Retries pick up from whatever the failed attempt kept
+            int attempt{0};
+            while (fetched == FETCH_RETRY || fetched == FETCH_TOO_SLOW) {
+                if (fetched == FETCH_TOO_SLOW && policy.lowSpeedLimit > MIN_LOW_SPEED_LIMIT) {
+                    // The link is slower than its history says: remember that and lower
+                    // the floor rather than spend a retry or count it as a failure
+                    curl_off_t speed{0};
+                    curl_easy_getinfo(curl.get(), CURLINFO_SPEED_DOWNLOAD_T, &speed);
+                    config.recordThroughput(host, static_cast<int>(std::min<curl_off_t>(speed, 0x7FFFFFFF)));
+                    policy.lowSpeedLimit = std::max(MIN_LOW_SPEED_LIMIT, policy.lowSpeedLimit / 4);
+                    curl_easy_setopt(curl.get(), CURLOPT_LOW_SPEED_LIMIT, policy.lowSpeedLimit);
+                }
+                else if (++attempt > policy.retries) break;
+                else std::this_thread::sleep_for(std::chrono::milliseconds(500 * attempt));
+
+                ++stats->retries;
+                fetched = fetch(curl.get(), config, host, fileName, stats);
+            }
+            stats->downloadSeconds += secondsSince(phaseStart);
+            ++stats->sources;
+
+            if (fetched == FETCH_NOT_MODIFIED) {
+                // Its entries were ingested when the kept list was downloaded
+                curl_off_t firstByte{0};
+                curl_easy_getinfo(curl.get(), CURLINFO_STARTTRANSFER_TIME_T, &firstByte);
+                config.recordSuccess(host, static_cast<int>(firstByte / 1000), 0);
+                ++stats->notModified;
+            }
+            else if (fetched == FETCH_COMPLETE) {
+                curl_off_t firstByte{0}, speed{0}, received{0};
+                curl_easy_getinfo(curl.get(), CURLINFO_STARTTRANSFER_TIME_T, &firstByte);
+                curl_easy_getinfo(curl.get(), CURLINFO_SIZE_DOWNLOAD_T, &received);
+                if (received >= MIN_THROUGHPUT_SAMPLE) curl_easy_getinfo(curl.get(), CURLINFO_SPEED_DOWNLOAD_T, &speed);
+                config.recordSuccess(host, static_cast<int>(firstByte / 1000),
+                                     static_cast<int>(std::min<curl_off_t>(speed, 0x7FFFFFFF)));
+
+                phaseStart = std::chrono::steady_clock::now();
+                file.open(fileName);
+                if (!file.fail()) {
+                    // One transaction per list, rather than one per entry
+                    config.beginTransaction();
+                    try {
+                        std::string line;
+                        while(std::getline(file, line)) {
+                            config.insertEntry(host, line);
+                            ++stats->lines;
+                        }
+                    }
+                    catch (...) {
+                        config.rollbackTransaction();
+                        // Download the list again next time rather than trust a 304 for it
+                        config.downloadState(host, DownloadState());
+                        file.close();
+                        throw;
+                    }
+                    config.commitTransaction();
+                }
+                file.close();
+                stats->ingestSeconds += secondsSince(phaseStart);
+            }
+            else {
+                config.recordFailure(host);
+                ++stats->failures;
+            }
+        }
+    }
+
+    return true;
+}
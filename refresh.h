@@ -0,0 +1,31 @@
+#ifndef REFRESH_H
+#define REFRESH_H
+
+#include <string>
+#include <vector>
+#include "config.h"
+
+// Time spent and work done by one call to downloadSources()
+struct RefreshStats {
+    double downloadSeconds{0};
+    double ingestSeconds{0};
+    size_t bytes{0};
+    size_t lines{0};
+    size_t sources{0};
+    size_t failures{0};
+    size_t retries{0};
+    size_t skipped{0};
+    size_t notModified{0}; // Sources whose kept list was still current
+};
+
+/*
+ * Download every source in urls and insert its entries into config.
+ * The URLs are expected to have been validated already (see Config::addHostsSrc()).
+ * Each source's health history in config decides its timeouts and retries, and
+ * whether it is skipped for now; the outcome is recorded back into the history.
+ * Downloads are kept in config.cacheDir(), see Config::cacheDir().
+ * Returns false if libcurl could not be initialized or that directory is unusable.
+ */
+bool downloadSources(Config &config, const std::vector<std::string> &urls, RefreshStats *stats = nullptr);
+
+#endif // REFRESH_H
@@ -0,0 +1,204 @@
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include "dnsserver.h"
+
+/*
+ * Runs DNSServer on 127.0.0.1 against a stub upstream on another loopback
+ * port and checks the answers it gives and relays.
+ */
+static const uint16_t TYPE_A{1};
+static const uint16_t TYPE_MX{15};
+static const uint16_t TYPE_AAAA{28};
+
+static int failures{0};
+
+static void check(bool condition, const std::string &what) {
+    if (!condition) {
+        std::cerr << "FAILED: " << what << std::endl;
+        ++failures;
+    }
+}
+
+static uint16_t read16(const std::string &packet, size_t pos) {
+    return static_cast<uint16_t>((static_cast<unsigned char>(packet[pos]) << 8) | static_cast<unsigned char>(packet[pos + 1]));
+}
+
+static void write16(std::string &packet, uint16_t value) {
+    packet += static_cast<char>(value >> 8);
+    packet += static_cast<char>(value & 0xFF);
+}
+
+static std::string question(const std::string &name, uint16_t qtype) {
+    std::string question;
+    size_t start{0};
+    while (start < name.length()) {
+        size_t end = name.find('.', start);
+        if (end == std::string::npos) end = name.length();
+        question += static_cast<char>(end - start);
+        question += name.substr(start, end - start);
+        start = end + 1;
+    }
+    question += '\0';
+    write16(question, qtype);
+    write16(question, 1);
+    return question;
+}
+
+static std::string query(uint16_t id, const std::string &name, uint16_t qtype) {
+    std::string packet;
+    write16(packet, id);
+    write16(packet, 0x0100); // RD
+    write16(packet, 1);
+    write16(packet, 0);
+    write16(packet, 0);
+    write16(packet, 0);
+    return packet + question(name, qtype);
+}
+
+// An upstream answer to query with a single A record for ip
+static std::string reply(const std::string &query, uint16_t id, const std::string &ip) {
+    std::string packet;
+    write16(packet, id);
+    write16(packet, 0x8180);
+    write16(packet, 1);
+    write16(packet, 1);
+    write16(packet, 0);
+    write16(packet, 0);
+    packet += query.substr(12);
+    write16(packet, 0xC00C);
+    write16(packet, TYPE_A);
+    write16(packet, 1);
+    write16(packet, 0);
+    write16(packet, 300);
+    write16(packet, 4);
+    in_addr address;
+    inet_pton(AF_INET, ip.c_str(), &address);
+    packet.append(reinterpret_cast<const char*>(&address), 4);
+    return packet;
+}
+
+static int udpSocket(uint16_t &port) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in local;
+    std::memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(local);
+    if (fd < 0 || bind(fd, reinterpret_cast<sockaddr*>(&local), sizeof(local)) != 0 ||
+            getsockname(fd, reinterpret_cast<sockaddr*>(&local), &length) != 0)
+        throw std::runtime_error("Could not open a test socket");
+    port = ntohs(local.sin_port);
+
+    timeval timeout{1, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    return fd;
+}
+
+static void sendTo(int fd, const std::string &packet, uint16_t port) {
+    sockaddr_in to;
+    std::memset(&to, 0, sizeof(to));
+    to.sin_family = AF_INET;
+    to.sin_port = htons(port);
+    to.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    sendto(fd, packet.data(), packet.length(), 0, reinterpret_cast<sockaddr*>(&to), sizeof(to));
+}
+
+// Empty on timeout
+static std::string receive(int fd, sockaddr_in *from = nullptr) {
+    char buffer[65536];
+    socklen_t length = sizeof(sockaddr_in);
+    ssize_t received = recvfrom(fd, buffer, sizeof(buffer), 0, reinterpret_cast<sockaddr*>(from), from ? &length : nullptr);
+    return received > 0 ? std::string(buffer, static_cast<size_t>(received)) : std::string();
+}
+
+static std::string ask(int client, uint16_t serverPort, uint16_t id, const std::string &name, uint16_t qtype) {
+    sendTo(client, query(id, name, qtype), serverPort);
+    return receive(client);
+}
+
+// The RDATA of the only answer, or empty if there is none
+static std::string answerData(const std::string &reply, const std::string &name, uint16_t qtype) {
+    size_t answer = 12 + question(name, qtype).length();
+    if (reply.length() < answer + 12 || read16(reply, 6) != 1) return "";
+    return reply.substr(answer + 12, read16(reply, answer + 10));
+}
+
+int main() {
+    std::unique_ptr<DomainIndex> index{new DomainIndex()};
+    index->insert("ads.example.com", "127.0.0.1");
+    index->insert("zero.example.com", "0.0.0.0");
+    index->build();
+    std::unique_ptr<PatternMatcher> patterns{new PatternMatcher()};
+    patterns->add("*.tracker.example.net");
+    patterns->compile();
+    index->setPatterns(std::move(patterns), "127.0.0.1");
+
+    uint16_t upstreamPort, clientPort;
+    int upstream = udpSocket(upstreamPort);
+    int client = udpSocket(clientPort);
+
+    DNSServer server(0, "127.0.0.1", upstreamPort);
+    server.bind();
+    server.update(std::move(index));
+    std::thread worker([&server]() -> void { server.run(); });
+    uint16_t port = server.port();
+    check(port != 0, "server bound to a port");
+
+    const std::string loopback("\x7f\0\0\x01", 4);
+    const std::string loopback6 = std::string(15, '\0') + '\x01';
+
+    std::string answer = ask(client, port, 0x1111, "Ads.Example.COM", TYPE_A);
+    check(read16(answer, 0) == 0x1111, "blocked A keeps the query ID");
+    check(answer.length() > 3 && (answer[3] & 0x0F) == 0, "blocked A is NOERROR");
+    check(answerData(answer, "Ads.Example.COM", TYPE_A) == loopback, "blocked A answers 127.0.0.1");
+
+    answer = ask(client, port, 0x2222, "ads.example.com", TYPE_AAAA);
+    check(answerData(answer, "ads.example.com", TYPE_AAAA) == loopback6, "blocked AAAA answers ::1");
+    answer = ask(client, port, 0x2223, "zero.example.com", TYPE_AAAA);
+    check(answerData(answer, "zero.example.com", TYPE_AAAA) == std::string(16, '\0'), "blocked AAAA answers ::");
+
+    answer = ask(client, port, 0x3333, "a.b.tracker.example.net", TYPE_A);
+    check(answerData(answer, "a.b.tracker.example.net", TYPE_A) == loopback, "pattern hit answers 127.0.0.1");
+
+    answer = ask(client, port, 0x4444, "ads.example.com", TYPE_MX);
+    check(read16(answer, 0) == 0x4444 && read16(answer, 6) == 0 && (answer[3] & 0x0F) == 0,
+          "other query types for blocked names get NODATA");
+    check(receive(upstream).empty(), "blocked names are not relayed");
+
+    // Relayed query: forged replies must be dropped, the real one passed on under the client's ID
+    std::string original = query(0x5555, "allowed.example.org", TYPE_A);
+    sendTo(client, original, port);
+    sockaddr_in from;
+    std::string relayed = receive(upstream, &from);
+    check(relayed.substr(2) == original.substr(2), "relayed query is unchanged apart from its ID");
+    uint16_t upstreamID = relayed.empty() ? 0 : read16(relayed, 0);
+
+    auto answerFrom = [&](const std::string &packet) -> void {
+        sendto(upstream, packet.data(), packet.length(), 0, reinterpret_cast<sockaddr*>(&from), sizeof(from));
+    };
+    answerFrom(reply(query(0, "other.example.org", TYPE_A), upstreamID, "6.6.6.6"));
+    answerFrom(reply(relayed, static_cast<uint16_t>(upstreamID + 1), "6.6.6.7"));
+    answerFrom(reply(relayed, upstreamID, "10.0.0.1"));
+
+    answer = receive(client);
+    check(read16(answer, 0) == 0x5555, "relayed reply carries the client's ID");
+    check(answerData(answer, "allowed.example.org", TYPE_A) == std::string("\x0a\0\0\x01", 4),
+          "only the reply matching ID and question is relayed");
+    check(receive(client).empty(), "forged replies are not relayed");
+
+    server.stop();
+    worker.join();
+    close(upstream);
+    close(client);
+
+    if (failures == 0) std::cout << "All DNS server checks passed" << std::endl;
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,96 @@
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include "hostname.h"
+
+/*
+ * Checks hostname normalization: ASCII case folding, the Punycode encoder
+ * against the sample strings of RFC 3492 section 7.1, and the case folding
+ * that has to happen before an international label is encoded.
+ */
+static int failures{0};
+
+static void check(bool condition, const std::string &what) {
+    if (!condition) {
+        std::cerr << "FAILED: " << what << std::endl;
+        ++failures;
+    }
+}
+
+static std::string lower(std::string text) {
+    foldCase(&text[0], text.length());
+    return text;
+}
+
+// The RFC's outputs carry optional case annotations; encodeIDN() folds
+// labels to lower case first, which only changes the case of the output
+struct Sample {
+    const char *name;
+    const char *text;
+    const char *punycode;
+};
+
+static const Sample RFC3492_SAMPLES[]{
+    {"(A) Arabic (Egyptian)", u8"ليهمابتكلموشعربي؟", "egbpdaj6bu4bxfgehfvwxn"},
+    {"(B) Chinese (simplified)", u8"他们为什么不说中文", "ihqwcrb4cv8a8dqg056pqjye"},
+    {"(C) Chinese (traditional)", u8"他們爲什麽不說中文", "ihqwctvzc91f659drss3x8bo0yb"},
+    {"(D) Czech", u8"Pročprostěnemluvíčesky", "Proprostnemluvesky-uyb24dma41a"},
+    {"(E) Hebrew", u8"למההםפשוטלאמדבריםעברית", "4dbcagdahymbxekheh6e0a7fei0b"},
+    {"(F) Hindi (Devanagari)", u8"यहलोगहिन्दीक्योंनहींबोलसकतेहैं", "i1baa7eci9glrd9b2ae1bj0hfcgg6iyaf8o0a1dig0cd"},
+    {"(G) Japanese (kanji and hiragana)", u8"なぜみんな日本語を話してくれないのか", "n8jok5ay5dzabd5bym9f0cm5685rrjetr6pdxa"},
+    {"(I) Russian (Cyrillic)", u8"почемужеонинеговорятпорусски", "b1abfaaepdrnnbgefbaDotcwatmq2g4l"},
+    {"(J) Spanish", u8"PorquénopuedensimplementehablarenEspañol", "PorqunopuedensimplementehablarenEspaol-fmd56a"},
+    {"(K) Vietnamese", u8"TạisaohọkhôngthểchỉnóitiếngViệt", "TisaohkhngthchnitingVit-kjcr8268qyxafd2f1b9g"},
+    {"(L) 3<nen>B<gumi><kinpachi><sensei>", u8"3年B組金八先生", "3B-ww4c5e180e575a65lsy2b"},
+    {"(M) <amuro><namie>-with-SUPER-MONKEYS", u8"安室奈美恵-with-SUPER-MONKEYS", "-with-SUPER-MONKEYS-pc58ag80a8qai00g7n9n"},
+    {"(N) Hello-Another-Way-<sorezore><no><basho>", u8"Hello-Another-Way-それぞれの場所", "Hello-Another-Way--fc4qua05auwb3674vfr0b"},
+    {"(O) <hitotsu><yane><no><shita>2", u8"ひとつ屋根の下2", "2-u9tlzr9756bt3uc0v"},
+    {"(P) Maji<de>Koi<suru>5<byou><mae>", u8"MajiでKoiする5秒前", "MajiKoi5-783gue6qz075azm5e"},
+    {"(Q) <pafii>de<runba>", u8"パフィーdeルンバ", "de-jg4avhby1noc0d"},
+    {"(R) <sono><supiido><de>", u8"そのスピードで", "d9juau41awczczp"},
+};
+
+static std::string encoded(std::string hostname) {
+    return encodeIDN(hostname) ? hostname : "<rejected>";
+}
+
+static std::string normalized(std::string hostname) {
+    return normalizeHostname(hostname) ? hostname : "<rejected>";
+}
+
+int main() {
+    char ascii[] = "WWW.Example-Site.COM.With.A.Long.Name.To.Cover.The.Vector.Loop";
+    check(!foldCase(ascii, std::strlen(ascii)), "foldCase() reports plain ASCII");
+    check(std::string(ascii) == "www.example-site.com.with.a.long.name.to.cover.the.vector.loop",
+          "foldCase() lowers every ASCII letter, inside and after the vector loop");
+    std::string mixed = u8"Ads.BÜCHER.Example.Com.And.Some.More.Bytes";
+    check(foldCase(&mixed[0], mixed.length()), "foldCase() reports non-ASCII bytes");
+    check(mixed == u8"ads.bÜcher.example.com.and.some.more.bytes", "foldCase() leaves non-ASCII bytes alone");
+
+    for (const Sample &sample : RFC3492_SAMPLES) {
+        std::string expected = "xn--" + lower(sample.punycode);
+        check(encoded(sample.text) == expected, std::string("RFC 3492 sample ") + sample.name);
+    }
+    // (H) encodes to 69 characters, past the 63 allowed in a label
+    check(encoded(u8"세계의모든사람들이한국어를이해한다면얼마나좋을까") == "<rejected>",
+          "labels longer than 63 bytes are rejected");
+
+    check(encoded(u8"ads.bücher.de") == "ads.xn--bcher-kva.de", "only the international label is encoded");
+    check(encoded(u8"MÜNCHEN.de") == encoded(u8"münchen.de") && encoded(u8"münchen.de") == "xn--mnchen-3ya.de",
+          "Latin-1 capitals are folded before encoding");
+    check(encoded(u8"ŁÓDŹ.pl") == encoded(u8"łódź.pl"), "Latin Extended-A capitals are folded");
+    check(encoded(u8"ΑΘΗΝΑ.gr") == encoded(u8"αθηνα.gr"), "Greek capitals are folded");
+    check(encoded(u8"МОСКВА.рф") == encoded(u8"москва.рф"), "Cyrillic capitals are folded");
+    check(encoded(u8"\u212Aelvin.example") == "kelvin.example",
+          "labels that fold to ASCII, like the Kelvin sign, are not encoded");
+    check(encoded(u8"İstanbul.tr") == "<rejected>", "capitals with a multi-code point lower case are rejected");
+    check(encoded("bad\xC3.example") == "<rejected>", "truncated UTF-8 is rejected");
+    check(encoded("bad\xC0\xAF.example") == "<rejected>", "overlong UTF-8 is rejected");
+
+    check(normalized(u8"Ads.MÜNCHEN.DE..") == "ads.xn--mnchen-3ya.de", "normalizeHostname() folds, strips and encodes");
+    check(normalized("Example.COM.") == "example.com", "normalizeHostname() handles plain ASCII");
+
+    if (failures == 0) std::cout << "All hostname checks passed" << std::endl;
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
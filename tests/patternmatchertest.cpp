@@ -0,0 +1,153 @@
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include "patternmatcher.h"
+
+/*
+ * Checks the blacklist pattern matcher: globs, the regular expression subset,
+ * rejection of patterns the parser doesn't support, and that a matcher whose
+ * DFA is capped gives the same answers by falling back to the NFA.
+ */
+static int failures{0};
+
+static void check(bool condition, const std::string &what) {
+    if (!condition) {
+        std::cerr << "FAILED: " << what << std::endl;
+        ++failures;
+    }
+}
+
+static PatternMatcher compiled(const std::string &pattern) {
+    PatternMatcher matcher;
+    matcher.add(pattern);
+    matcher.compile();
+    return matcher;
+}
+
+static void expect(const std::string &pattern, const std::string &domain, bool expected) {
+    PatternMatcher matcher = compiled(pattern);
+    check(matcher.matches(domain) == expected,
+          "'" + pattern + "' should " + (expected ? "" : "not ") + "match '" + domain + "'");
+}
+
+static bool rejected(const std::string &pattern) {
+    try {
+        PatternMatcher::validate(pattern);
+    }
+    catch (const std::invalid_argument &) {
+        return true;
+    }
+    return false;
+}
+
+static const char *PATTERNS[]{
+    "*.doubleclick.net",
+    "ads*.example.com",
+    "ad?.example.org",
+    "^track[0-9]+\\.",
+    "^ads\\.example\\.com$",
+    "^(ads|track|pixel)\\.",
+    "^a{2,3}\\.",
+    "^[a-z]*x[a-z]{4}\\.",
+    "^[^.]*metrics[0-9]{1,4}\\.[a-z]+$",
+};
+
+static const char *DOMAINS[]{
+    "doubleclick.net", "ads.doubleclick.net", "a.b.doubleclick.net", "notdoubleclick.net",
+    "ads.example.com", "ads1.cdn.example.com", "bads.example.com", "ads.example.com.au",
+    "ad1.example.org", "ad.example.org", "ad12.example.org",
+    "track12.foo.com", "tracker.foo.com", "xtrack1.foo.com",
+    "pixel.foo.com", "adstrack.foo.com",
+    "aa.foo", "aaa.foo", "a.foo", "aaaa.foo",
+    "boxabcd.foo", "xabcd.foo", "abxabc.foo", "xxxxxxxxxxxxxx.foo", "abcdefx.foo",
+    "webmetrics42.com", "webmetrics42.co.uk", "metrics12345.com", "metrics1.example",
+    "", "example.com",
+};
+
+int main() {
+    // Globs cover the whole domain
+    expect("*.doubleclick.net", "ads.doubleclick.net", true);
+    expect("*.doubleclick.net", "a.b.doubleclick.net", true);
+    expect("*.doubleclick.net", "doubleclick.net", false);
+    expect("*.doubleclick.net", "notdoubleclick.net", false);
+    expect("*.doubleclick.net", "ads.doubleclick.net.evil.com", false);
+    expect("ads*.example.com", "ads.example.com", true);
+    expect("ads*.example.com", "ads1.example.com", true);
+    expect("ads*.example.com", "adserver.cdn.example.com", true);
+    expect("ads*.example.com", "bads.example.com", false);
+    expect("ads*.example.com", "ads.example.com.au", false);
+    expect("ad?.example.org", "ad1.example.org", true);
+    expect("ad?.example.org", "ad.example.org", false);
+    expect("ad?.example.org", "ad12.example.org", false);
+    expect("*.Tracker.NET", "a.tracker.net", true);
+
+    // Regular expressions are anchored at the start and match a prefix
+    expect("^track[0-9]+\\.", "track12.foo.com", true);
+    expect("^track[0-9]+\\.", "track1.", true);
+    expect("^track[0-9]+\\.", "tracker.foo.com", false);
+    expect("^track[0-9]+\\.", "track.foo.com", false);
+    expect("^track[0-9]+\\.", "xtrack1.foo.com", false);
+    expect("^ads\\.example\\.com", "ads.example.com.au", true);
+    expect("^ads\\.example\\.com$", "ads.example.com", true);
+    expect("^ads\\.example\\.com$", "ads.example.com.au", false);
+    expect("^(ads|track)\\.", "ads.foo.com", true);
+    expect("^(ads|track)\\.", "track.foo.com", true);
+    expect("^(ads|track)\\.", "adstrack.foo.com", false);
+    expect("^(?:ads|)x\\.", "x.foo.com", true);
+    expect("^a{2,3}\\.", "aa.foo", true);
+    expect("^a{2,3}\\.", "aaa.foo", true);
+    expect("^a{2,3}\\.", "a.foo", false);
+    expect("^a{2,3}\\.", "aaaa.foo", false);
+    expect("^a{2}\\.", "aa.foo", true);
+    expect("^a{2}\\.", "aaa.foo", false);
+    expect("^a{2,}\\.", "aaaaaaaa.foo", true);
+    expect("^\\d+\\.\\w+$", "42.example", true);
+    expect("^\\d+\\.\\w+$", "42.example.com", false);
+    expect("^[^.]+\\.com$", "example.com", true);
+    expect("^[^.]+\\.com$", "www.example.com", false);
+
+    PatternMatcher none;
+    none.compile();
+    check(none.empty() && !none.matches("example.com"), "an empty matcher matches nothing");
+
+    check(!rejected("^(ads|track)[0-9]{1,3}\\.$"), "a valid regular expression is accepted");
+    check(!rejected("*.example.com"), "a glob is accepted");
+    check(rejected(""), "an empty pattern is rejected");
+    check(rejected("^(ads"), "an unclosed group is rejected");
+    check(rejected("^ads)"), "an unopened group is rejected");
+    check(rejected("^[a-"), "an unclosed class is rejected");
+    check(rejected("^[z-a]"), "a reversed range is rejected");
+    check(rejected("^*ads"), "a repetition of nothing is rejected");
+    check(rejected("^ads$+"), "a repetition of an anchor is rejected");
+    check(rejected("^a{3,1}"), "a reversed repetition count is rejected");
+    check(rejected("^a{2"), "an unclosed repetition count is rejected");
+    check(rejected("^a{1000}"), "a huge repetition count is rejected");
+    check(rejected("^ads\\"), "a trailing backslash is rejected");
+    check(rejected("^\\bads"), "an unsupported escape is rejected");
+    check(rejected("^(?=ads)"), "lookahead is rejected");
+
+    // A cap this small forces compile() to stop building the DFA early and
+    // matches() to finish on the NFA, which must not change any answer
+    PatternMatcher full;
+    PatternMatcher capped(4);
+    for (const char *pattern : PATTERNS) {
+        full.add(pattern);
+        capped.add(pattern);
+    }
+    full.compile();
+    capped.compile();
+    check(full.dfaStates() > 4 && full.dfaStates() < PatternMatcher::MAX_DFA_STATES,
+          "the test patterns need more DFA states than the small cap");
+    check(capped.dfaStates() == 4, "the small cap limits the DFA");
+    for (const char *domain : DOMAINS) {
+        bool expected{false};
+        for (const char *pattern : PATTERNS)
+            expected = expected || compiled(pattern).matches(domain);
+        check(full.matches(domain) == expected, std::string("combined patterns on '") + domain + "'");
+        check(capped.matches(domain) == expected, std::string("NFA fallback on '") + domain + "'");
+    }
+
+    if (failures == 0) std::cout << "All pattern matcher checks passed" << std::endl;
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}